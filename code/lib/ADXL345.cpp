@@ -33,9 +33,10 @@ boolean ADXL345::ReadRawAxis(AccelerometerRaw *raw) {
 	//If we did not get the data we expected
 	if(rv != 6) return false;
 
-	raw->XAxis = (buffer[1] << 8) | buffer[0];
-	raw->YAxis = (buffer[3] << 8) | buffer[2];
-	raw->ZAxis = (buffer[5] << 8) | buffer[4];
+	//Each axis is 16 bit two's complement, which int is not when built for the host checks
+	raw->XAxis = (int16_t) ((buffer[1] << 8) | buffer[0]);
+	raw->YAxis = (int16_t) ((buffer[3] << 8) | buffer[2]);
+	raw->ZAxis = (int16_t) ((buffer[5] << 8) | buffer[4]);
 	return true;
 }
 
@@ -64,6 +65,16 @@ void ADXL345::EnableMeasurements() {
 	Write(Register_PowerControl, 0x08);
 }
 
+/*
+ * Is the part in measurement mode? This is cleared when the part loses power, so it
+ * doubles as a check that the other configuration registers are still valid.
+ */
+boolean ADXL345::MeasurementsEnabled() {
+	uint8_t data[1];
+	if(Read(Register_PowerControl, 1, data) != 1) return false;
+	return (data[0] & 0x08) != 0;
+}
+
 int ADXL345::SetRange(int range, bool fullResolution) {
 	//Get current data from this register.
 	uint8_t data[1];
@@ -99,6 +110,53 @@ int ADXL345::SetRange(int range, bool fullResolution) {
 	return 0;
 }
 
+/*
+ * Set the output data rate (one of the ADXL345_RATE_* values). This is also the rate
+ * at which the FIFO fills.
+ */
+void ADXL345::SetDataRate(unsigned char rate) {
+	Write(Register_BWRate, rate & 0x0F);
+}
+
+/*
+ * Configure the FIFO. mode is one of ADXL345_FIFO_*. In stream and trigger modes
+ * samples is the watermark level (in FIFO mode it is ignored by the part and the
+ * FIFO simply fills to ADXL345_FIFO_SIZE then stops). Switching to bypass mode
+ * empties the FIFO.
+ */
+void ADXL345::SetFifoMode(unsigned char mode, unsigned char samples) {
+	Write(Register_FifoControl, (mode & 0xC0) | (samples & 0x1F));
+}
+
+/*
+ * How many samples are currently waiting in the FIFO.
+ * Returns 0 if the status register could not be read.
+ */
+unsigned char ADXL345::FifoEntries() {
+	uint8_t data[1];
+	if(Read(Register_FifoStatus, 1, data) != 1) return 0;
+	return data[0] & 0x3F;
+}
+
+/*
+ * Drain up to max samples from the FIFO into buf in a single burst.
+ * Each entry is popped by a 6 byte read of the data registers, so the
+ * status register is only read once for the whole window.
+ * Returns the number of samples read.
+ */
+unsigned char ADXL345::ReadRawFifo(AccelerometerRaw *buf, unsigned char max) {
+#ifndef ENABLE_SENSORS
+	return 0;
+#endif
+	unsigned char entries = FifoEntries();
+	if(entries > max) entries = max;
+
+	for(unsigned char i = 0; i < entries; i++) {
+		if(!ReadRawAxis(&buf[i])) return i;
+	}
+	return entries;
+}
+
 uint8_t ADXL345::EnsureConnected() {
 	return i2cidentify(m_Address, 0x00, 0xE5);
 }
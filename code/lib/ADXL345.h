@@ -28,16 +28,35 @@ Updated and extended by Ian Gray, 2013.
 
 #define DefaultADXL345_Address 0x1D
 
+#define Register_BWRate 0x2C
 #define Register_PowerControl 0x2D
 #define Register_DataFormat 0x31
 #define Register_DataX 0x32
 #define Register_DataY 0x34
 #define Register_DataZ 0x36
+#define Register_FifoControl 0x38
+#define Register_FifoStatus 0x39
 
 #define Register_XOffset 0x1E
 #define Register_YOffset 0x1F
 #define Register_ZOffset 0x20
 
+//FIFO modes (top two bits of FIFO_CTL)
+#define ADXL345_FIFO_BYPASS 0x00
+#define ADXL345_FIFO_FIFO 0x40
+#define ADXL345_FIFO_STREAM 0x80
+#define ADXL345_FIFO_TRIGGER 0xC0
+
+//Entries held by the FIFO
+#define ADXL345_FIFO_SIZE 32
+
+//Output data rates for the BW_RATE register
+#define ADXL345_RATE_25HZ 0x08
+#define ADXL345_RATE_50HZ 0x09
+#define ADXL345_RATE_100HZ 0x0A
+#define ADXL345_RATE_200HZ 0x0B
+#define ADXL345_RATE_400HZ 0x0C
+
 #define ScaleFor2G 0.0039
 #define ScaleFor4G 0.0078
 #define ScaleFor8G 0.0156
@@ -63,9 +82,16 @@ class ADXL345 {
 	  boolean ReadScaledAxis(AccelerometerScaled *scaled);
 	  int SetRange(int range, bool fullResolution);
 	  void EnableMeasurements();
+	  boolean MeasurementsEnabled();
 	  void SetOffset(int x, int y, int z);
 	  unsigned char EnsureConnected();
 
+	  //FIFO support
+	  void SetDataRate(unsigned char rate);
+	  void SetFifoMode(unsigned char mode, unsigned char samples);
+	  unsigned char FifoEntries();
+	  unsigned char ReadRawFifo(AccelerometerRaw *buf, unsigned char max);
+
 	protected:
 	  void Write(int address, int byte);
 	  int Read(int address, int length, unsigned char *buffer);
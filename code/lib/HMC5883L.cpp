@@ -32,6 +32,7 @@ Updated, extended (and fixed) by Ian Gray, 2013.
 
 HMC5883L::HMC5883L() {
 	m_Scale = 0.73;
+	m_DrdyPin = -1;
 }
 
 boolean HMC5883L::ReadRawAxis(MagnetometerRaw *raw) {
@@ -44,9 +45,10 @@ boolean HMC5883L::ReadRawAxis(MagnetometerRaw *raw) {
 	//If we did not get the data we expected
 	if(rv != 6) return false;
 
-	raw->XAxis = (buffer[0] << 8) | buffer[1];
-	raw->ZAxis = (buffer[2] << 8) | buffer[3];
-	raw->YAxis = (buffer[4] << 8) | buffer[5];
+	//Each axis is 16 bit two's complement, which int is not when built for the host checks
+	raw->XAxis = (int16_t) ((buffer[0] << 8) | buffer[1]);
+	raw->ZAxis = (int16_t) ((buffer[2] << 8) | buffer[3]);
+	raw->YAxis = (int16_t) ((buffer[4] << 8) | buffer[5]);
 	return true;
 }
 
@@ -58,12 +60,83 @@ boolean HMC5883L::ReadScaledAxis(MagnetometerScaled *scaled) {
 	if(ReadRawAxis(&raw) == false) {
 		return false;
 	}
-	scaled->XAxis = raw.XAxis * m_Scale;
-	scaled->ZAxis = raw.ZAxis * m_Scale;
-	scaled->YAxis = raw.YAxis * m_Scale;
+	Scale(&raw, scaled);
 	return true;
 }
 
+void HMC5883L::Scale(MagnetometerRaw *raw, MagnetometerScaled *scaled) {
+	scaled->XAxis = raw->XAxis * m_Scale;
+	scaled->ZAxis = raw->ZAxis * m_Scale;
+	scaled->YAxis = raw->YAxis * m_Scale;
+}
+
+/*
+ * Is a new measurement waiting in the data output registers?
+ * Uses the DRDY pin if one has been set with SetDataReadyPin(), otherwise polls the
+ * RDY bit of the status register.
+ */
+boolean HMC5883L::DataReady() {
+	if(m_DrdyPin >= 0) {
+		//DRDY is pulled high and drops low for 250us once data is placed in the output registers
+		return digitalRead(m_DrdyPin) == LOW;
+	}
+
+	uint8_t status[1];
+	if(Read(StatusRegister, 1, status) != 1) return false;
+	return status[0] & 0x01;
+}
+
+/*
+ * Trigger a single measurement, wait for it to complete, then burst read the result.
+ * The part returns to idle mode afterwards, so it draws no measurement current between
+ * calls. This avoids the stale or half-updated samples that can be read in continuous mode.
+ * Returns false if the measurement did not complete within COMPASS_SINGLESHOT_TIMEOUT_MS.
+ */
+boolean HMC5883L::ReadSingleShot(MagnetometerRaw *raw) {
+#ifndef ENABLE_SENSORS
+	return true;
+#endif
+	unsigned long start;
+
+	SetMeasurementMode(COMPASS_MEASURE_SINGLESHOT);
+
+	start = millis();
+	while(!DataReady()) {
+		if(millis() - start > COMPASS_SINGLESHOT_TIMEOUT_MS) return false;
+	}
+
+	return ReadRawAxis(raw);
+}
+
+boolean HMC5883L::ReadScaledSingleShot(MagnetometerScaled *scaled) {
+#ifndef ENABLE_SENSORS
+	return true;
+#endif
+	MagnetometerRaw raw;
+	if(ReadSingleShot(&raw) == false) {
+		return false;
+	}
+	Scale(&raw, scaled);
+	return true;
+}
+
+/*
+ * Set how many samples the part averages for each measurement (one of COMPASS_AVERAGE_*).
+ * This also restores normal measurement configuration and the default 15Hz output rate.
+ */
+void HMC5883L::SetAveraging(uint8_t average) {
+	Write(ConfigurationRegisterA, ((average & 0x03) << 5) | (COMPASS_RATE_15HZ << 2));
+}
+
+/*
+ * Use the DRDY pin to detect completed measurements, rather than polling the status
+ * register over I2C. Pass -1 to go back to polling.
+ */
+void HMC5883L::SetDataReadyPin(int pin) {
+	m_DrdyPin = pin;
+	if(pin >= 0) pinMode(pin, INPUT);
+}
+
 boolean HMC5883L::SetScale(char gauss) {
 	uint8_t regValue = gauss;
 
@@ -100,4 +173,4 @@ void HMC5883L::Write(int address, int data) {
 int HMC5883L::Read(int address, int length, uint8_t *buffer) {
 	return i2cread(HMC5883L_Address, address, length, buffer);
 }
-
+
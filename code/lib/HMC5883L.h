@@ -34,6 +34,7 @@ Updated and extended by Ian Gray, 2013.
 #define ConfigurationRegisterB 0x01
 #define ModeRegister 0x02
 #define DataRegisterBegin 0x03
+#define StatusRegister 0x09
 #define IdentityRegister 0x0A
 #define IdentityRegisterValue 0x48
 
@@ -41,6 +42,18 @@ Updated and extended by Ian Gray, 2013.
 #define COMPASS_MEASURE_SINGLESHOT 0x01
 #define COMPASS_MEASURE_IDLE 0x03
 
+//Samples averaged per measurement (config register A, bits 6:5)
+#define COMPASS_AVERAGE_1 0
+#define COMPASS_AVERAGE_2 1
+#define COMPASS_AVERAGE_4 2
+#define COMPASS_AVERAGE_8 3
+
+//Data output rate for continuous mode (config register A, bits 4:2). 15Hz is the power-on default.
+#define COMPASS_RATE_15HZ 4
+
+//Longest we will wait for a single-shot measurement to complete
+#define COMPASS_SINGLESHOT_TIMEOUT_MS 30
+
 #define GAUSS_0_88 0
 #define GAUSS_1_3  1
 #define GAUSS_1_9  2
@@ -74,6 +87,12 @@ class HMC5883L
   
 	  void SetMeasurementMode(uint8_t mode);
 	  boolean SetScale(char gauss);
+	  void SetAveraging(uint8_t average);
+	  void SetDataReadyPin(int pin);
+
+	  boolean DataReady();
+	  boolean ReadSingleShot(MagnetometerRaw *raw);
+	  boolean ReadScaledSingleShot(MagnetometerScaled *scaled);
 
 	  boolean EnsureConnected();
 	protected:
@@ -81,6 +100,8 @@ class HMC5883L
 	  int Read(int address, int length, uint8_t *buffer);
 
 	private:
+	  void Scale(MagnetometerRaw *raw, MagnetometerScaled *scaled);
 	  float m_Scale;
+	  int m_DrdyPin;
 };
-#endif
+#endif
@@ -23,9 +23,24 @@
 
 #include <avr/wdt.h>
 #include <avr/sleep.h>
+#include "Arduino.h"
 #include "Narcoleptic.h"
 
+static volatile bool wdt_fired;
+static volatile unsigned int wdt_slices; //8 second slices left in delay8secs()
+
 SIGNAL(WDT_vect) {
+  wdt_fired = true;
+
+  //Part way through delay8secs() the watchdog is left running. This decrement and the
+  //loop in delay8secs() are all that an intermediate wake executes (around 45 instructions
+  //including the interrupt prologue), though the oscillator start-up time still applies.
+  if (wdt_slices > 1) {
+    wdt_slices--;
+    return;
+  }
+  wdt_slices = 0;
+
   wdt_disable();
   wdt_reset();
   WDTCSR &= ~_BV(WDIE);
@@ -47,7 +62,30 @@ void NarcolepticClass::sleep(uint8_t wdt_period) {
  * (2^15-1)*8 / (60*60) = 72.8 hours, or slightly over 3 days.
  */
 void NarcolepticClass::delay8secs(int eightsecs) {
-	while (eightsecs > 0) { sleep(WDTO_8S); eightsecs--; }
+  if (eightsecs <= 0) return;
+
+  wdt_slices = eightsecs;
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+
+  //Watchdog in interrupt-only mode with an 8 second period. Unlike wdt_enable() this does
+  //not arm the system reset, so the watchdog keeps running from one slice to the next
+  //without being set up again on every wake.
+  cli();
+  wdt_reset();
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDIE) | _BV(WDP3) | _BV(WDP0);
+
+  for (;;) {
+    //Interrupts are off while checking, so the last slice cannot end between the check and the sleep
+    if (wdt_slices == 0) break;
+    sleep_enable();
+    sleep_bod_disable(); //Only lasts for the next sleep, so must be repeated every slice
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+  sei();
 }
 
 void NarcolepticClass::delay(int milliseconds) {
@@ -63,4 +101,24 @@ void NarcolepticClass::delay(int milliseconds) {
   if (milliseconds >= 16)      { sleep(WDTO_15MS); milliseconds -= 15; }
 }
 
+/*
+ * Time one watchdog period against the crystal driven micros().
+ * The processor idles rather than powering down so that Timer0 keeps counting.
+ * Returns the length of the period in microseconds.
+ */
+unsigned long NarcolepticClass::measureWatchdog(uint8_t wdt_period) {
+  unsigned long start;
+
+  wdt_fired = false;
+  wdt_enable(wdt_period);
+  wdt_reset();
+  WDTCSR |= _BV(WDIE);
+  start = micros();
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  while (!wdt_fired) sleep_mode();
+
+  return micros() - start;
+}
+
 NarcolepticClass Narcoleptic;
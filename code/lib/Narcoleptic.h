@@ -27,6 +27,7 @@ class NarcolepticClass
   public:
     void delay(int milliseconds);
     void delay8secs(int eightsecs);
+    unsigned long measureWatchdog(uint8_t wdt_period);
   private:
     void sleep(uint8_t);
 };
@@ -9,6 +9,7 @@
 #include <Arduino.h>
 #include <avr/pgmspace.h>
 #include "notes.h"
+#include "capture.h"
 
 const prog_uint16_t notes[] PROGMEM = {
 		0, NOTE_C4, NOTE_CS4, NOTE_D4, NOTE_DS4, NOTE_E4, NOTE_F4, NOTE_FS4, NOTE_G4, NOTE_GS4, NOTE_A4, NOTE_AS4, NOTE_B4,
@@ -107,6 +108,7 @@ int RTTTL::play() {
 #ifdef ENABLE_PIEZO
 		noTone(pin);
 #endif
+		CAPTURE_TONE(0);
 		this->noteon = false;
 	}
 
@@ -116,6 +118,7 @@ int RTTTL::play() {
 #ifdef ENABLE_PIEZO
 		noTone(pin);
 #endif
+		CAPTURE_TONE(0);
 		return -1;
 	}
 
@@ -177,6 +180,7 @@ int RTTTL::play() {
 			noTone(pin);
 			tone(pin, pgm_read_word(&notes[(scale - 4) * 12 + note]));
 #endif
+			CAPTURE_TONE(pgm_read_word(&notes[(scale - 4) * 12 + note]));
 			noteon = true;
 			//Call back into the animation
 			callinganim->beat_callback();
@@ -7,12 +7,22 @@
 #include "compass.h"
 #include "options.h"
 #include "notes.h"
+#include "entropy.h"
+#include "config.h"
+#include "peripherals.h"
+#include "battery.h"
+#include "capture.h"
+#include "telemetry.h"
+
+#define LOG_FILE 1
+#include "tokenlog.h"
 #include <avr/pgmspace.h>
 
 extern ADXL345 accel;
 extern HMC5883L compass;
 
-unsigned char brightcols[NUM_BRIGHTCOLS][3] = {
+//Saturated colours, kept in flash. Use brightcol() to read one.
+static const unsigned char brightcols[NUM_BRIGHTCOLS][3] PROGMEM = {
 		{LED_SCANMAX, 0, 0},
 		{0, LED_SCANMAX, 0},
 		{0, 0, LED_SCANMAX},
@@ -21,6 +31,14 @@ unsigned char brightcols[NUM_BRIGHTCOLS][3] = {
 		{0, LED_SCANMAX, LED_SCANMAX}
 };
 
+Colour brightcol(unsigned char i) {
+	Colour c;
+	c.r = pgm_read_byte(&brightcols[i][0]);
+	c.g = pgm_read_byte(&brightcols[i][1]);
+	c.b = pgm_read_byte(&brightcols[i][2]);
+	return c;
+}
+
 
 //----------------------------------------------------------------------
 
@@ -33,6 +51,7 @@ unsigned char brightcols[NUM_BRIGHTCOLS][3] = {
  */
 void play_animation(Animation *anim, long timeout) {
 	unsigned long thistime, timeouttime, lastframetime = 0, lastsensetime = 0;
+	unsigned long tick_us = 0; //Longest tick
 	unsigned long nextsoundtime = 0;
 	long soundrv;
 	boolean soundsneeded;
@@ -43,7 +62,14 @@ void play_animation(Animation *anim, long timeout) {
 	start_led_scanner();
 #endif
 
+#ifdef ENABLE_PIEZO
+	//tone() runs on Timer2
+	peripheral_acquire(PERIPH_TIMER2);
+#endif
+
 	enable_sensors();
+	//Animations poll the magnetometer often, so let it convert continuously
+	compass.SetMeasurementMode(COMPASS_MEASURE_CONTINUOUS);
 
 	soundsneeded = anim->sounds.valid;
 
@@ -57,8 +83,10 @@ void play_animation(Animation *anim, long timeout) {
 		if(thistime >= lastsensetime + SENSE_MS) {
 			AccelerometerScaled acc;
 			MagnetometerScaled mag;
+			unsigned long sensestart = micros();
 			if(accel.ReadScaledAxis(&acc) && compass.ReadScaledAxis(&mag)) {
-				getHeading(mag, acc);
+				int heading = updateOrientation(mag, acc);
+				if(TELEMETRY_ENABLED) telemetry_sensors(acc, mag, heading, micros() - sensestart);
 			} else {
 				//Could not fetch values so discard them for this loop.
 			}
@@ -67,14 +95,19 @@ void play_animation(Animation *anim, long timeout) {
 
 		//Kill any animation if magnetically pacified
 		if(magneticallyPacified(compass)) {
-			DEBUGln("Magnetically pacified from animation.");
+			LOG0("Magnetically pacified from animation.");
 			break;
 		}
 
 		//Check for the next graphics frame
 		if(thistime >= lastframetime + TICK_MS) {
+			unsigned long tickstart = micros();
+
 			//Check for animation complete
 			if(!anim->tick()) break;
+			unsigned long us = micros() - tickstart;
+			if(us > tick_us) tick_us = us;
+			CAPTURE_FRAME();
 			lastframetime = thistime;
 		}
 
@@ -86,9 +119,15 @@ void play_animation(Animation *anim, long timeout) {
 			} else {
 				soundsneeded = false;
 			}
+			//Beat callbacks set LEDs between ticks
+			CAPTURE_FRAME();
 		}
 	}
 
+	//The cost of a frame, and of the fades and dithering the scanner runs each PWM cycle (see leds.cpp),
+	//so that an animation which fades by hand each tick can be compared with one using fadeLED8()
+	LOG2("Longest tick us: %lu, longest LED cycle us: %u", tick_us, led_cycle_us());
+
 	disable_sensors();
 	clearLEDs();
 
@@ -98,6 +137,7 @@ void play_animation(Animation *anim, long timeout) {
 
 #ifdef ENABLE_PIEZO
 	noTone(PIEZO_PIN_1);
+	peripheral_release(PERIPH_TIMER2);
 #endif
 
 }
@@ -133,9 +173,9 @@ boolean ScanFade::tick() {
 //----------------------------------------------------------------------
 
 boolean Twinkle::tick() {
-	unsigned char tochange = random(1, 3);
+	unsigned char tochange = random8(1, 3);
 	for(unsigned char x = 0; x < tochange; x++) {
-		setLED(random(0, NUMLEDS), random(0, LED_SCANMAX - 1), random(0, LED_SCANMAX - 1), random(0, LED_SCANMAX - 1));
+		setLED(random8(0, NUMLEDS), random8(0, LED_SCANMAX - 1), random8(0, LED_SCANMAX - 1), random8(0, LED_SCANMAX - 1));
 	}
 	return !this->sounds.play_done();
 }
@@ -144,36 +184,24 @@ boolean Twinkle::tick() {
 
 Pulse::Pulse() : Animation(NULL) {
 	clearLEDs();
-	val = 0;
-	frame = 0;
 	pulsecount = 0;
 }
 
+//Each pulse is one fade from black, run by the LED scanner, so a tick only waits for it to end
 boolean Pulse::tick() {
-	unsigned char r, g, b;
-
-	switch(pulsecount) {
-	case 0: r = 0; g = 0; b = val; break;
-	case 1: r = val; g = 0; b = 0; break;
-	default: r = 0; g = val; b = 0; break;
-	}
-
-	frame++;
-	if(frame == 1) {
-		val++;
-		if(val >= LED_SCANMAX) {
-			val = 0;
-			pulsecount++;
-		}
-		frame = 0;
-	}
+	if(leds_fading()) return true;
+	if(pulsecount >= 3) return false;
 
 	for(unsigned char i = 0; i < NUMLEDS; i++) {
-		setLED(i, r, g, b);
+		setLED(i, 0, 0, 0);
+		switch(pulsecount) {
+		case 0: fadeLED8(i, 0, 0, 255, LED_SCANMAX * TICK_MS); break;
+		case 1: fadeLED8(i, 255, 0, 0, LED_SCANMAX * TICK_MS); break;
+		default: fadeLED8(i, 0, 255, 0, LED_SCANMAX * TICK_MS); break;
+		}
 	}
-
-	if(pulsecount >= 3) return false;
-	else return true;
+	pulsecount++;
+	return true;
 }
 
 //----------------------------------------------------------------------
@@ -223,7 +251,7 @@ boolean BeatIndicator::tick() {
 
 void BeatIndicator::beat_callback() {
 	for(unsigned char x = 0; x < 5; x++) {
-		setLED(random(0, NUMLEDS), random(0, LED_SCANMAX - 1), random(0, LED_SCANMAX - 1), random(0, LED_SCANMAX - 1));
+		setLED(random8(0, NUMLEDS), random8(0, LED_SCANMAX - 1), random8(0, LED_SCANMAX - 1), random8(0, LED_SCANMAX - 1));
 	}
 }
 
@@ -242,9 +270,9 @@ void FiveLights::beat_callback() {
 	clearLEDs();
 	if(beatcount == 0) getSides(this->sides);
 	if(beatcount == 4) {
-		setLED(getTop(), random(0, 8), random(0, 8), random(0, 8));
+		setLED(getTop(), random8(0, 8), random8(0, 8), random8(0, 8));
 	} else {
-		setLED(sides[beatcount], random(0, 8), random(0, 8), random(0, 8));
+		setLED(sides[beatcount], random8(0, 8), random8(0, 8), random8(0, 8));
 	}
 	beatcount++;
 }
@@ -303,7 +331,7 @@ boolean TinyFanfare::tick() {
 void TinyFanfare::beat_callback() {
 	clearLEDs();
     for (int i=0; i<6; i++) {
-        setLED(i, brightcols[onbeat%6][0], brightcols[onbeat%6][1], brightcols[onbeat%6][2]);
+        setLED(i, brightcol(onbeat%6));
         onbeat++;
     }
     onbeat++;
@@ -385,7 +413,7 @@ Cobo::Cobo() : Animation(CoboRTTTL) {
 boolean Cobo::tick() {
 	if (onbeat>=16) {
         for (int i=0; i<6; i++) {
-            setLED(i, HSV_to_RGB(((onbeat%40*9)+i*60)%360,100,100));
+            setLED8(i, HSV_to_RGB(((onbeat%40*9)+i*60)%360,100,100));
         }
        onbeat++;
     }
@@ -448,7 +476,7 @@ boolean SMT::tick() {
 
 void SMT::beat_callback() {
     for (int i=0;i<6;i++) {
-        setLED(i,brightcols[i][0],brightcols[i][1],brightcols[i][2]);
+        setLED(i,brightcol(i));
     }
 }
 
@@ -607,7 +635,7 @@ boolean HCock::tick() {
 
 void HCock::beat_callback() {
 	clearLEDs();
-    setLED(random(0,6),255,255,255);
+    setLED(random8(0,6),255,255,255);
 }
 
 //----------------------------------------------------------------------
@@ -621,57 +649,30 @@ Unhappy::Unhappy() : Animation(NULL) {
 	statecount = 0;
 	state = 0;
 	happyreadings = 0;
+	gaveup = false;
+}
+
+//True if the animation ended because the cube was unhappy for too long, rather than being calmed
+boolean Unhappy::gaveUp() {
+	return gaveup;
 }
 
 boolean Unhappy::tick() {
 	float hue;
 	byte r, g, b;
 
-	//Should we be vibrating?
-	if(unhappiness > BEHAVIOUR_VIBRATE_THRESHOLD) {
+	//Should we be vibrating? On a weak battery the motor is pulsed, or not run at all.
+	if(unhappiness > BEHAVIOUR_VIBRATE_THRESHOLD && (unhappiness & 3) < battery_vibrate_duty()) {
 		vibrate_on();
 	} else {
 		vibrate_off();
 	}
 
-	//Check if we've been freaking out too long
+	//Check if we've been freaking out too long. If so give up, and the behaviour goes apoplectic.
 	if(unhappiness > BEHAVIOUR_APOPLEXY_THRESHOLD) {
-		int apoSleepCycles = 0;
-		unhappiness = 0; //I guess he just doesn't love us. Best not get the police called on him.
-		happyreadings = 0;
-		MagnetometerScaled rawwhensleep;
-		compass.ReadScaledAxis(&rawwhensleep);
-
-		for(int i = 0; i < BEHAVIOUR_APOPLEXY_SLEEP_8SECS; i++) {
-			MagnetometerScaled newmag;
-			power_sleep_long(2);
-			enable_sensors();
-			refresh_sensors();
-
-			//Has the cube been poked?
-			compass.ReadScaledAxis(&newmag);
-			if((abs(newmag.XAxis - rawwhensleep.XAxis) > 20) || (abs(newmag.YAxis - rawwhensleep.YAxis) > 20) || (abs(newmag.ZAxis - rawwhensleep.ZAxis) > 20)) {
-				start_led_scanner();
-				enable_sensors();
-				break;
-			}
-
-			//Pulse the leds red
-			if(apoSleepCycles >= 4) {
-				apoSleepCycles = 0;
-				start_led_scanner();
-				for(int x = 0; x < 2; x++) {
-					for(unsigned char i = 0; i < 6; i++) setLED(i, 7, 0, 0);
-					delay(300);
-					clearLEDs();
-					delay(80);
-				}
-			} else {
-				apoSleepCycles++;
-			}
-		}
-
-		//Back to freaking out then...
+		vibrate_off();
+		gaveup = true;
+		return false;
 	}
 	unhappiness++;
 
@@ -699,7 +700,7 @@ boolean Unhappy::tick() {
 	if(getBearingFace() == -1) {
 		//Nose is up or down so all but the nose (which will be set further down)
 		for(unsigned char led = 0; led < 6; led++) {
-			setLED(led, r, g, b);
+			setLED8(led, r, g, b);
 		}
 	} else {
 		//Nose is side on, so use the state to determine
@@ -709,7 +710,7 @@ boolean Unhappy::tick() {
 		switch(state) {
 		case 0:
 			//Tail only
-			setLED(oppositeFace(getNose()), r, g, b);
+			setLED8(oppositeFace(getNose()), r, g, b);
 			break;
 		case 1:
 			//Top, bottom and sides that aren't the tail or nose
@@ -717,7 +718,7 @@ boolean Unhappy::tick() {
 				if(led == getNose() || led == oppositeFace(getNose())) {
 					//Cleared above
 				} else {
-					setLED(led, r, g, b);
+					setLED8(led, r, g, b);
 				}
 			}
 			break;
@@ -732,10 +733,10 @@ boolean Unhappy::tick() {
 	if(noseflash >= 2) {
 		noseflash = 0;
 		if(noseflash_r == 0 && noseflash_g == 0 && noseflash_b == 0) {
-			unsigned char col = random(0, NUM_BRIGHTCOLS);
-			noseflash_r = brightcols[col][0];
-			noseflash_g = brightcols[col][1];
-			noseflash_b = brightcols[col][2];
+			Colour col = brightcol(random8(0, NUM_BRIGHTCOLS));
+			noseflash_r = col.r;
+			noseflash_g = col.g;
+			noseflash_b = col.b;
 		} else {
 			noseflash_r = 0;
 			noseflash_g = 0;
@@ -755,10 +756,11 @@ boolean Unhappy::tick() {
 	noTone(PIEZO_PIN_1);
 	tone(PIEZO_PIN_1, (NOTE_C6 - NOTE_A1) * percent + NOTE_A1);
 #endif
+	CAPTURE_TONE((NOTE_C6 - NOTE_A1) * percent + NOTE_A1);
 
 
-	//Now check the sensors for if we are correctly oriented yet
-	if(pointingCorrectly(BEHAVIOUR_BEARING_LEEWAY)) {
+	//Now check the sensors for if we are correctly oriented yet (and not still being handled)
+	if(pointingCorrectly(BEHAVIOUR_BEARING_LEEWAY, ORIENT_CONFIDENT)) {
 		happyreadings++;
 	}
 
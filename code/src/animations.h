@@ -3,10 +3,11 @@
 
 #include "Arduino.h"
 #include "options.h"
+#include "leds.h"
 #include <avr/pgmspace.h>
 
 #define NUM_BRIGHTCOLS 6
-extern unsigned char brightcols[NUM_BRIGHTCOLS][3];
+Colour brightcol(unsigned char i);
 
 //----------------------------------------------------------------------
 
@@ -75,8 +76,6 @@ public:
 	Pulse();
 	boolean tick();
 private:
-	unsigned char frame;
-	unsigned char val;
 	unsigned char pulsecount;
 };
 
@@ -202,6 +201,7 @@ class Unhappy : public Animation {
 public:
 	Unhappy();
 	boolean tick();
+	boolean gaveUp();
 private:
 	int unhappiness;
 	unsigned char noseflash;
@@ -209,6 +209,7 @@ private:
 	unsigned char statecount;
 	unsigned char state;
 	unsigned char happyreadings;
+	boolean gaveup;
 };
 
 //----------------------------------------------------------------------
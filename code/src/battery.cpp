@@ -0,0 +1,113 @@
+#include "Arduino.h"
+#include "options.h"
+#include "battery.h"
+#include "config.h"
+#include "leds.h"
+#include "eventlog.h"
+#include "peripherals.h"
+#include "timekeeping.h"
+
+/*
+ * Battery monitor.
+ *
+ * The supply is never wired to an analogue pin, so it is measured backwards: the ADC uses
+ * AVcc as its reference and converts the internal 1.1V bandgap. The lower the supply, the
+ * larger the reading. The bandgap varies by 10% from part to part, so its voltage is
+ * calibrated once against a meter (battery_calibrate()) and kept in config.bandgap_mv.
+ * A measurement takes a few milliseconds with the ADC powered, so it is only taken every
+ * BATTERY_SAMPLE_SECS and the result is cached.
+ *
+ * The cached voltage is turned into a level from 255 (at or above BATTERY_GOOD_MV) down to 0
+ * (at or below BATTERY_FLAT_MV), which the behaviour policy below scales with.
+ */
+
+static unsigned int cached_mv = 0;
+static unsigned char level = 255;
+static unsigned long sampled_at = 0;
+static boolean low_logged = false;
+
+//Measure the supply voltage in millivolts
+unsigned int battery_measure_mv() {
+	unsigned int reading;
+
+	peripheral_acquire(PERIPH_ADC);
+	ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1); //AVcc reference, 1.1V bandgap input
+	ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0); //Enable, clock / 128
+	delay(2); //Let the bandgap and the reference settle
+
+	//The first conversion after switching the input is not trustworthy, so take two
+	for(unsigned char i = 0; i < 2; i++) {
+		ADCSRA |= _BV(ADSC);
+		while(ADCSRA & _BV(ADSC));
+	}
+	reading = ADC;
+
+	ADCSRA = 0;
+	peripheral_release(PERIPH_ADC);
+
+	if(reading == 0) return 0;
+	return ((unsigned long) config.bandgap_mv * 1024) / reading;
+}
+
+/*
+ * Calibrate the bandgap from the supply voltage in millivolts as measured with a meter, and save it.
+ * Returns false, changing nothing, if that would put the bandgap outside its specified range.
+ */
+boolean battery_calibrate(unsigned int actual_mv) {
+	unsigned int measured = battery_measure_mv();
+	unsigned long bandgap;
+
+	if(measured == 0) return false;
+	bandgap = ((unsigned long) config.bandgap_mv * actual_mv + measured / 2) / measured;
+	if(bandgap < BANDGAP_MIN_MV || bandgap > BANDGAP_MAX_MV) return false;
+
+	config.bandgap_mv = bandgap;
+	save_config();
+	cached_mv = 0; //Measure again at the next update
+	return true;
+}
+
+//Take a new measurement if the cached one is due for renewal, and apply it to the LEDs
+void battery_update() {
+	unsigned long now = uptime_seconds();
+
+	if(cached_mv != 0 && now - sampled_at < BATTERY_SAMPLE_SECS) return;
+	sampled_at = now;
+	cached_mv = battery_measure_mv();
+
+	if(cached_mv >= BATTERY_GOOD_MV) {
+		level = 255;
+	} else if(cached_mv <= BATTERY_FLAT_MV) {
+		level = 0;
+	} else {
+		level = ((unsigned long) (cached_mv - BATTERY_FLAT_MV) * 255) / (BATTERY_GOOD_MV - BATTERY_FLAT_MV);
+	}
+
+	if(level == 0 && !low_logged) {
+		log_event(EVENT_BATTERY_FLAT, cached_mv / 20);
+		low_logged = true;
+	}
+
+	//Dim the LEDs down to half brightness as the battery goes flat
+	set_led_scan_period(LED_SCANMAX + ((unsigned int) LED_SCANMAX * (255 - level)) / 255);
+}
+
+//The last measured supply voltage in millivolts (0 if none has been taken)
+unsigned int battery_mv() {
+	return cached_mv;
+}
+
+//0 (flat) to 255 (good)
+unsigned char battery_level() {
+	return level;
+}
+
+//Stretch a time between animations, up to four times as long on a flat battery
+unsigned int battery_stretch(unsigned int gap) {
+	return gap + ((unsigned long) gap * 3 * (255 - level)) / 255;
+}
+
+//How many ticks out of every four the vibration motor may run. None at all on a flat battery.
+unsigned char battery_vibrate_duty() {
+	return (level + 63) / 64;
+}
@@ -0,0 +1,13 @@
+#ifndef __BATTERY_H_
+#define __BATTERY_H_
+
+unsigned int battery_measure_mv();
+boolean battery_calibrate(unsigned int actual_mv);
+void battery_update();
+unsigned int battery_mv();
+unsigned char battery_level();
+
+unsigned int battery_stretch(unsigned int gap);
+unsigned char battery_vibrate_duty();
+
+#endif
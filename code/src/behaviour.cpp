@@ -0,0 +1,295 @@
+#include "Arduino.h"
+#include "options.h"
+#include "behaviour.h"
+#include "HMC5883L.h"
+#include "animations.h"
+#include "compass.h"
+#include "leds.h"
+#include "utils.h"
+#include "entropy.h"
+#include "config.h"
+#include "eventlog.h"
+#include "timekeeping.h"
+#include "peripherals.h"
+#include "battery.h"
+#include "shell.h"
+
+#define LOG_FILE 2
+#include "tokenlog.h"
+
+extern HMC5883L compass;
+
+/*
+ * The cube's behaviour as a state machine.
+ *
+ * Each wake runs the current state, which may hand over to other states straight away (e.g. a
+ * happy check that finds the cube facing the wrong way moves to unhappy). Eventually a state
+ * asks to sleep, and says how long for. behaviour_step() does one such wake, and behaviour_run()
+ * is the scheduler which sleeps for exactly as long as the step asked.
+ *
+ * No state sleeps itself; everything that used to wait in nested loops (e.g. apoplexy) keeps
+ * its progress in the variables below and picks up again on the next wake.
+ */
+
+static unsigned char state = BEHAVIOUR_HAPPY_CHECK; //The state to run on the next wake
+static boolean asleep = false;
+static boolean first_decision = true; //No happy/unhappy decision made since reset
+
+static int anims_to_nose_change;
+static unsigned long next_anim_time; //Uptime in seconds
+static unsigned long unhappy_since; //Uptime in seconds
+static unsigned long apoplexy_since; //sleep_count when apoplexy began
+static unsigned long apoplexy_began; //Uptime in seconds
+static unsigned char apoplexy_wakes;
+static MagnetometerScaled mag_when_apoplectic;
+
+//---------------------------------------------------------------------------------
+
+const prog_char misland[] PROGMEM = "m:d=4,o=5,b=220:8e6,8p,8e6,8g6,8f#6,8e6,d6,2e6,8p,8d6,8p,8d6,8c6,8b,8d6,8c6,8p,8c6,8p,b";
+const prog_char close5[] PROGMEM = "c:d=16,o=5,b=140:d,p,e,p,c,p,c4,p,g4";
+const prog_char triad[] PROGMEM = "a:d=16,o=5,b=200:c,32p,e,32p,g";
+
+void playHappyAnim(int select) {
+	if(select == -1) select = random8(0, HAPPY_ANIM_COUNT);
+
+	switch(select){
+	case 0: {Twinkle a(NULL); play_animation(&a, 2000);} break;
+	case 1: {FiveLights a(close5); play_animation(&a, -1);} break;
+	case 2: {Pulse a; play_animation(&a, -1);} break;
+	case 3: {BeatIndicator a(misland); play_animation(&a, -1);} break;
+	case 4: {ScanFade a; play_animation(&a, 1000);} break;
+	case 5: {Circle a(NULL); play_animation(&a, -1);} break;
+	case 6: {Twinkle a(triad); play_animation(&a, 1000);} break;
+	case 7: {TinyFanfare a; play_animation(&a, -1);} break;
+	case 8: {Scatman a; play_animation(&a, -1);} break;
+	case 9: {Triple a; play_animation(&a, -1);} break;
+	case 10: {Cobo a; play_animation(&a, -1);} break;
+	case 11: {MOTD a; play_animation(&a, -1);} break;
+	case 12: {SMT a; play_animation(&a, -1);} break;
+	case 13: {Tetris a; play_animation(&a, -1);} break;
+	case 14: {Intel a; play_animation(&a, -1);} break;
+	case 15: {Chirp a; play_animation(&a, -1);} break;
+	case 16: {HCock a; play_animation(&a, -1);} break;
+
+	default: {Twinkle tw(NULL); play_animation(&tw, 2000);} break;
+	}
+}
+
+//---------------------------------------------------------------------------------
+
+static void schedule_next_anim() {
+	next_anim_time = uptime_seconds() + BEHAVIOUR_TIME_BETWEEN_ANIMS_8SECS * 8UL;
+}
+
+//How many watchdog sleeps (at least 1, at most maxsleeps) until the given uptime
+static unsigned int sleeps_until(unsigned long when, unsigned int maxsleeps) {
+	unsigned long now = uptime_seconds();
+	unsigned long period = wdt_period_ms();
+	unsigned long sleeps;
+
+	if(when <= now) return 1;
+	sleeps = ((when - now) * 1000UL + period - 1) / period;
+	if(sleeps > maxsleeps) sleeps = maxsleeps;
+	if(sleeps < 1) sleeps = 1;
+	return sleeps;
+}
+
+/*
+ * Called once, at the first happy/unhappy decision after reset. Boot leaves the sensors to the
+ * first orientation check rather than bringing them up separately, so the PRNG is seeded here,
+ * from the same wake, before anything random happens. The first animation and nose change are
+ * drawn only then, or every cube would start on the same schedule. Reports how long boot took
+ * to decide.
+ */
+static void boot_decided() {
+	LOG1("Reset to first decision ms: %lu", millis());
+	gather_entropy();
+	anims_to_nose_change = BEHAVIOUR_ANIMS_BETWEEN_NOSE_CHANGES;
+	schedule_next_anim();
+	first_decision = false;
+}
+
+static void pulse_red() {
+	start_led_scanner();
+	for(unsigned char x = 0; x < 2; x++) {
+		for(unsigned char i = 0; i < NUMLEDS; i++) setLED(i, LED_SCANMAX - 1, 0, 0);
+		delay(300);
+		clearLEDs();
+		delay(80);
+	}
+	stop_led_scanner();
+}
+
+//---------------------------------------------------------------------------------
+// State handlers. Each returns the number of 8 second sleeps to take, or 0 to run the new state now.
+
+static unsigned int happy_check() {
+	enable_sensors();
+	refresh_sensors();
+
+	if(magneticallyPacified(compass)) {
+		LOG0("Magnetically pacified.");
+		log_event(EVENT_PACIFIED, 0);
+		state = BEHAVIOUR_PACIFIED;
+		return BEHAVIOUR_CHECK_8SECS;
+	}
+
+	LOG2("Sensor bring-up us: %lu  first heading us: %lu", sensor_bringup_us, first_heading_us);
+	LOG3("Sleep entry us: %lu  awake us: %lu over %u wakes", sleep_entry_us, sleep_awake_us, sleep_slices);
+
+	boolean happy = pointingCorrectly(BEHAVIOUR_BEARING_LEEWAY);
+	if(first_decision) boot_decided();
+
+	if(!happy) {
+		LOG0("Unhappy");
+		unhappy_since = uptime_seconds();
+		log_event(EVENT_UNHAPPY, 0);
+		state = BEHAVIOUR_UNHAPPY;
+		return 0;
+	}
+
+	LOG3("Happy - uptime: %lu  nextAnimTime: %lu  animsToNoseChange: %d", uptime_seconds(), next_anim_time, anims_to_nose_change);
+	if(uptime_seconds() >= next_anim_time) {
+		state = BEHAVIOUR_ANIMATING;
+		return 0;
+	}
+
+	return sleeps_until(next_anim_time, BEHAVIOUR_CHECK_8SECS);
+}
+
+static unsigned int animating() {
+	playHappyAnim();
+	schedule_next_anim();
+
+	if(--anims_to_nose_change <= 0) {
+		//Change the nose (i.e. trigger a freak out)
+		unsigned char newnose = random8(0, 6);
+		while(newnose == getNose()) newnose = random8(0, 6);
+		setNose(newnose);
+		log_event(EVENT_NOSE_CHANGE, newnose);
+		LOG1("Nose changed to %u", newnose);
+
+		//How many animations before it will change the nose again?
+		anims_to_nose_change = BEHAVIOUR_ANIMS_BETWEEN_NOSE_CHANGES;
+	}
+
+	state = BEHAVIOUR_HAPPY_CHECK;
+	return BEHAVIOUR_CHECK_8SECS;
+}
+
+//Freak out, progressively more and more, until correctly oriented again.
+//However if we get apoplectic its possible the owner is out, so calm down for a bit.
+static unsigned int unhappy() {
+	Unhappy unhappyAnim;
+	play_animation(&unhappyAnim, -1);
+
+	if(unhappyAnim.gaveUp()) {
+		//Remember the field now, so that we can tell if the cube gets moved while we sulk
+		enable_sensors();
+		compass.ReadScaledSingleShot(&mag_when_apoplectic);
+		apoplexy_since = sleep_count;
+		apoplexy_began = uptime_seconds();
+		apoplexy_wakes = 0;
+		log_event(EVENT_APOPLEXY, 0);
+		state = BEHAVIOUR_APOPLECTIC;
+		return BEHAVIOUR_APOPLEXY_CHECK_8SECS;
+	}
+
+	log_event(EVENT_CALMED, min(uptime_seconds() - unhappy_since, 255));
+	HappyAnim hap;
+	play_animation(&hap, -1);
+	schedule_next_anim();
+	anims_to_nose_change = BEHAVIOUR_ANIMS_BETWEEN_NOSE_CHANGES;
+
+	state = BEHAVIOUR_HAPPY_CHECK;
+	return 0;
+}
+
+static unsigned int apoplectic() {
+	MagnetometerScaled mag;
+	boolean poked;
+
+	enable_sensors();
+	refresh_sensors();
+	compass.ReadScaledAxis(&mag);
+	poked = (abs(mag.XAxis - mag_when_apoplectic.XAxis) > BEHAVIOUR_POKE_THRESHOLD)
+			|| (abs(mag.YAxis - mag_when_apoplectic.YAxis) > BEHAVIOUR_POKE_THRESHOLD)
+			|| (abs(mag.ZAxis - mag_when_apoplectic.ZAxis) > BEHAVIOUR_POKE_THRESHOLD);
+
+	if(!poked) {
+		if(++apoplexy_wakes >= BEHAVIOUR_APOPLEXY_PULSE_WAKES) {
+			apoplexy_wakes = 0;
+			pulse_red();
+		}
+		if(sleep_count - apoplexy_since < (unsigned long) BEHAVIOUR_APOPLEXY_SLEEP_8SECS * BEHAVIOUR_APOPLEXY_CHECK_8SECS) {
+			return BEHAVIOUR_APOPLEXY_CHECK_8SECS;
+		}
+	}
+
+	//Back to freaking out then...
+	log_event(EVENT_APOPLEXY_ENDED, min((uptime_seconds() - apoplexy_began) / 60, 255));
+	state = BEHAVIOUR_UNHAPPY;
+	return 0;
+}
+
+static unsigned int pacified() {
+	enable_sensors();
+	refresh_sensors();
+
+	if(magneticallyPacified(compass)) return BEHAVIOUR_CHECK_8SECS;
+
+	state = BEHAVIOUR_HAPPY_CHECK;
+	return 0;
+}
+
+//---------------------------------------------------------------------------------
+
+void behaviour_init() {
+	state = BEHAVIOUR_HAPPY_CHECK;
+	asleep = false;
+}
+
+/*
+ * Run one wake of the behaviour: states run until one of them wants to sleep.
+ * Returns how many 8 second sleeps to take before the next step.
+ */
+unsigned int behaviour_step() {
+	unsigned int sleeps = 0;
+
+	asleep = false;
+	if(DEBUG || shell_host_attached()) {
+		serial_on();
+		shell_poll();
+	}
+
+	//Occasionally re-measure the battery, which scales back the behaviour as it runs down
+	battery_update();
+
+	while(sleeps == 0) {
+		switch(state) {
+		case BEHAVIOUR_ANIMATING: sleeps = animating(); break;
+		case BEHAVIOUR_UNHAPPY: sleeps = unhappy(); break;
+		case BEHAVIOUR_APOPLECTIC: sleeps = apoplectic(); break;
+		case BEHAVIOUR_PACIFIED: sleeps = pacified(); break;
+		default: sleeps = happy_check(); break;
+		}
+	}
+
+	asleep = true;
+	return sleeps;
+}
+
+//The scheduler. Never returns. While a host is attached it stays awake to serve the shell.
+void behaviour_run() {
+	behaviour_init();
+	while(1) {
+		unsigned int sleeps = behaviour_step();
+		if(shell_host_attached()) awake_wait(sleeps);
+		else power_sleep_long(sleeps);
+	}
+}
+
+//The state currently running, or BEHAVIOUR_SLEEPING between steps
+unsigned char behaviour_state() {
+	return asleep ? BEHAVIOUR_SLEEPING : state;
+}
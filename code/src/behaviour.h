@@ -0,0 +1,21 @@
+#ifndef __BEHAVIOUR_H_
+#define __BEHAVIOUR_H_
+
+//Behaviour states
+#define BEHAVIOUR_SLEEPING 0
+#define BEHAVIOUR_HAPPY_CHECK 1 //Awake, checking the orientation
+#define BEHAVIOUR_ANIMATING 2 //Playing a happy animation
+#define BEHAVIOUR_UNHAPPY 3 //Freaking out until correctly oriented
+#define BEHAVIOUR_APOPLECTIC 4 //Gave up freaking out, sleeping it off
+#define BEHAVIOUR_PACIFIED 5 //A pacification magnet is present
+
+void behaviour_init();
+unsigned int behaviour_step();
+void behaviour_run();
+unsigned char behaviour_state();
+
+//Number of animations playHappyAnim() chooses between
+#define HAPPY_ANIM_COUNT 17
+void playHappyAnim(int select = -1);
+
+#endif
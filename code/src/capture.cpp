@@ -0,0 +1,73 @@
+#include "Arduino.h"
+#include "options.h"
+#include "capture.h"
+#include "leds.h"
+#include "animations.h"
+#include "behaviour.h"
+#include "peripherals.h"
+
+#ifdef ANIMATION_CAPTURE
+
+/*
+ * The capture is plain text so that it can be recorded with any serial terminal:
+ *
+ *   ANIM <id>
+ *   F <ms> <rrggbb x NUMLEDS>   the colours asked for after a tick or a beat, ms since ANIM
+ *   T <ms> <freq>               a note starts (freq 0 for silence)
+ *   END
+ *
+ * All numbers are hex. Colours are in native levels as getLED() gives them, so a dithered LED
+ * is recorded at the level nearest its colour, not whichever level this PWM cycle happens to show.
+ * The serial writes block, so the captured timing runs slightly slow.
+ * tools/hostcheck/check_capture.cpp makes the same capture on the host, to the exact timing.
+ */
+
+static unsigned long capture_start;
+
+static void print_hex(unsigned int v) {
+	if(v < 0x10) Serial.print('0');
+	Serial.print(v, HEX);
+}
+
+void capture_begin(int id) {
+	serial_on();
+	Serial.print(F("ANIM "));
+	Serial.println(id, HEX);
+	capture_start = millis();
+}
+
+void capture_frame() {
+	Serial.print(F("F "));
+	Serial.print(millis() - capture_start, HEX);
+	Serial.print(' ');
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		Colour c = getLED(i);
+		print_hex(c.r);
+		print_hex(c.g);
+		print_hex(c.b);
+	}
+	Serial.println();
+}
+
+void capture_tone(unsigned int freq) {
+	Serial.print(F("T "));
+	Serial.print(millis() - capture_start, HEX);
+	Serial.print(' ');
+	Serial.println(freq, HEX);
+}
+
+void capture_end() {
+	Serial.println(F("END"));
+	Serial.flush();
+}
+
+//Play every happy animation once, capturing each
+void capture_all() {
+	for(int i = 0; i < HAPPY_ANIM_COUNT; i++) {
+		capture_begin(i);
+		playHappyAnim(i);
+		capture_end();
+	}
+}
+
+#endif
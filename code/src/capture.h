@@ -0,0 +1,23 @@
+#ifndef __CAPTURE_H_
+#define __CAPTURE_H_
+
+/*
+ * Animation capture. With ANIMATION_CAPTURE defined (see options.h) each frame and each
+ * piezo note of every animation is written to the serial line, for tools/render_capture.py
+ * to turn into frame files, PNG strips and WAVs. Otherwise these all compile to nothing.
+ */
+#ifdef ANIMATION_CAPTURE
+#define CAPTURE_FRAME() capture_frame()
+#define CAPTURE_TONE(f) capture_tone((f))
+#else
+#define CAPTURE_FRAME()
+#define CAPTURE_TONE(f)
+#endif
+
+void capture_begin(int id);
+void capture_frame();
+void capture_tone(unsigned int freq);
+void capture_end();
+void capture_all();
+
+#endif
@@ -1,11 +1,22 @@
 #include "Arduino.h"
 #include "compass.h"
 #include "options.h"
+#include "config.h"
+
+#define LOG_FILE 3
+#include "tokenlog.h"
 
 unsigned char current_nose = 1;
 unsigned char cached_up;
 int cached_bearing;
-extern int target_bearing;
+
+//Orientation filter state. Fixed point with ORIENT_FRAC_BITS fractional bits.
+//Accelerometer axes are in 1/1024 G, magnetometer axes in the driver's scaled units.
+#define ORIENT_FRAC_BITS 4
+static long filt_acc[3];
+static long filt_mag[3];
+static boolean filt_valid = false;
+static unsigned char confidence = 0;
 
 //Prototypes for internal helpers
 float normaliseBearingRad(float bearing);
@@ -17,8 +28,8 @@ int normaliseBearingDeg(int bearing);
  * Get the heading for the magnetometer, based on the currently defined 'nose' face.
  *
  * Returns -1 if the nose face is vertically up or down, else returns the bearing in
- * degrees from magnetic north. Currently tilt compensation and declination corrections
- * are NOT performed.
+ * degrees from magnetic north. The magnetometer calibration in config.mag_calibration is applied
+ * first. Currently tilt compensation and declination corrections are NOT performed.
  *
  * This also caches its result, which is used for subsequent animation
  * calls. If this function is not called periodically, animations
@@ -36,6 +47,11 @@ int getHeading(MagnetometerScaled mag_scaled, AccelerometerScaled acc_scaled) {
 
 	upface = determineFace(acc_scaled);
 
+	//Correct for hard and soft iron distortion from the motor, battery and speaker
+	mag_scaled.XAxis = (mag_scaled.XAxis - config.mag_calibration[0]) * config.mag_calibration[3] / MAG_SCALE_ONE;
+	mag_scaled.YAxis = (mag_scaled.YAxis - config.mag_calibration[1]) * config.mag_calibration[4] / MAG_SCALE_ONE;
+	mag_scaled.ZAxis = (mag_scaled.ZAxis - config.mag_calibration[2]) * config.mag_calibration[5] / MAG_SCALE_ONE;
+
 	//Check if the nose is face up or down then bearing is meaningless
 	if(current_nose == upface || current_nose == oppositeFace(upface)) {
 		cached_bearing = -1;
@@ -121,6 +137,82 @@ int getHeading(MagnetometerScaled mag_scaled, AccelerometerScaled acc_scaled) {
 	return rv;
 }
 
+/*
+ * Feed a new sensor snapshot into the orientation filter and update the cached heading.
+ *
+ * This is a fixed point complementary filter. There is no gyro, so it low-pass filters the
+ * gravity and magnetic field vectors and takes the heading from the filtered vectors. Single
+ * noisy samples taken while the cube is being handled are smoothed out.
+ *
+ * Alongside this a confidence value (0-255) is kept. A snapshot agrees with the filter if the
+ * accelerometer reads close to 1G (i.e. the cube is not being moved) and every axis of both
+ * sensors is close to the filtered value. Confidence moves towards 255 for agreeing snapshots
+ * and towards 0 otherwise.
+ *
+ * Call this at SENSE_MS instead of getHeading(). Returns the filtered heading, as getHeading().
+ */
+int updateOrientation(MagnetometerScaled mag_scaled, AccelerometerScaled acc_scaled) {
+	long acc[3], mag[3];
+	long magnitude = 0;
+	int score = 255;
+
+	acc[0] = acc_scaled.XAxis * 1024;
+	acc[1] = acc_scaled.YAxis * 1024;
+	acc[2] = acc_scaled.ZAxis * 1024;
+	mag[0] = mag_scaled.XAxis;
+	mag[1] = mag_scaled.YAxis;
+	mag[2] = mag_scaled.ZAxis;
+
+	//Start from the first snapshot after a reset
+	if(!filt_valid) {
+		for(unsigned char i = 0; i < 3; i++) {
+			filt_acc[i] = acc[i] << ORIENT_FRAC_BITS;
+			filt_mag[i] = mag[i] << ORIENT_FRAC_BITS;
+		}
+		filt_valid = true;
+	}
+
+	//Does this snapshot agree with the filter?
+	for(unsigned char i = 0; i < 3; i++) {
+		magnitude += acc[i] * acc[i];
+		if(abs(acc[i] - (filt_acc[i] >> ORIENT_FRAC_BITS)) > ORIENT_ACC_TOLERANCE) score = 0;
+		if(abs(mag[i] - (filt_mag[i] >> ORIENT_FRAC_BITS)) > ORIENT_MAG_TOLERANCE) score = 0;
+	}
+	//Magnitude squared is in 1/2^20 G^2, so accept roughly 0.85G to 1.15G
+	if(magnitude < 757000L || magnitude > 1387000L) score = 0;
+
+	confidence = confidence + (score - (int)confidence) / 4;
+
+	//Move the filtered vectors towards the snapshot
+	for(unsigned char i = 0; i < 3; i++) {
+		filt_acc[i] += ((acc[i] << ORIENT_FRAC_BITS) - filt_acc[i]) >> ORIENT_FILTER_SHIFT;
+		filt_mag[i] += ((mag[i] << ORIENT_FRAC_BITS) - filt_mag[i]) >> ORIENT_FILTER_SHIFT;
+	}
+
+	acc_scaled.XAxis = (float)filt_acc[0] / (1024 << ORIENT_FRAC_BITS);
+	acc_scaled.YAxis = (float)filt_acc[1] / (1024 << ORIENT_FRAC_BITS);
+	acc_scaled.ZAxis = (float)filt_acc[2] / (1024 << ORIENT_FRAC_BITS);
+	mag_scaled.XAxis = (float)filt_mag[0] / (1 << ORIENT_FRAC_BITS);
+	mag_scaled.YAxis = (float)filt_mag[1] / (1 << ORIENT_FRAC_BITS);
+	mag_scaled.ZAxis = (float)filt_mag[2] / (1 << ORIENT_FRAC_BITS);
+
+	return getHeading(mag_scaled, acc_scaled);
+}
+
+/*
+ * Discard the filter history, so that the next snapshot is taken as-is.
+ * Called when the sensors are powered down as the cube may be moved before they return.
+ */
+void resetOrientation() {
+	filt_valid = false;
+	confidence = 0;
+}
+
+//How much the current heading can be trusted, from 0 (not at all) to 255
+unsigned char getHeadingConfidence() {
+	return confidence;
+}
+
 /*
  * Determine which face of the accelerometer is facing upwards.
  * A simple algorithm is used which seems to work well. The magnitude
@@ -179,16 +271,19 @@ unsigned char getTop() {
 
 /**
  * Is the nose pointing at the target bearing?
+ * If minconfidence is given then the filtered heading must also have at least that confidence.
  */
-boolean pointingCorrectly(int leeway) {
-	//DEBUGp("cached_bearing: "); DEBUGp(cached_bearing); DEBUGp("  target_bearing: "); DEBUGln(target_bearing);
+boolean pointingCorrectly(int leeway, unsigned char minconfidence) {
+	if(confidence < minconfidence) return false;
+
+	//LOG2("cached_bearing: %d  config.bearing: %d", cached_bearing, config.bearing);
 
 	if(cached_bearing == -1) return false;
 
-	int bearingoffset = abs(cached_bearing - target_bearing);
+	int bearingoffset = abs(cached_bearing - config.bearing);
 	if(bearingoffset > 180) bearingoffset = abs(bearingoffset - 360);
 
-	//DEBUGp("bearingoffset: "); DEBUGp(bearingoffset); DEBUGp("  leeway: "); DEBUGln(leeway);
+	//LOG2("bearingoffset: %d  leeway: %d", bearingoffset, leeway);
 
 	if(bearingoffset > leeway) return false;
 	else return true;
@@ -204,7 +299,7 @@ char getBearingFace() {
 		return -1;
 	}
 
-	int bearingoffset = cached_bearing - target_bearing;
+	int bearingoffset = cached_bearing - config.bearing;
 	bearingoffset = normaliseBearingDeg(bearingoffset);
 
 	if(bearingoffset >= 315 || bearingoffset < 45) {
@@ -321,7 +416,7 @@ unsigned char clockwise(unsigned char side) {
 unsigned char anticlockwise(unsigned char side) {
 	return clockwise(clockwise(clockwise(side)));
 }
-
+
 /*
  * Normalise a bearing by ensuring it is between 0 and 2*PI radians
  */
@@ -341,6 +436,35 @@ int normaliseBearingDeg(int bearing) {
 }
 
 
+/*
+ * Fit hard and soft iron corrections from the extremes of each magnetometer axis seen while
+ * the cube was rotated. A distorted field traces an offset ellipsoid rather than a sphere
+ * centred on zero.
+ * The centre of each axis range is the hard iron offset. Soft iron distortion is corrected
+ * along the sensor axes (a diagonal matrix): each axis is scaled so that its range matches
+ * the mean range of all three. buf is filled in the layout of config.mag_calibration.
+ */
+void fit_mag_calibration(const int *mins, const int *maxs, int16_t *buf) {
+	long radius[3];
+	long mean = 0;
+
+	for(unsigned char i = 0; i < 3; i++) {
+		buf[i] = ((long) mins[i] + maxs[i]) / 2;
+		radius[i] = ((long) maxs[i] - mins[i]) / 2;
+		mean += radius[i];
+	}
+	mean = mean / 3;
+
+	for(unsigned char i = 0; i < 3; i++) {
+		if(radius[i] > 0) {
+			buf[3 + i] = (mean * MAG_SCALE_ONE) / radius[i];
+		} else {
+			buf[3 + i] = MAG_SCALE_ONE; //Axis never moved, so leave it alone
+		}
+	}
+}
+
+
 /*
  * Has a magnet been placed next to the sensor to pacify the cube?
  * Assumes the sensors are on and updated!
@@ -5,6 +5,11 @@
 #include "HMC5883L.h"
 
 int getHeading(MagnetometerScaled mag_scaled, AccelerometerScaled acc_scaled);
+
+//Orientation filter
+int updateOrientation(MagnetometerScaled mag_scaled, AccelerometerScaled acc_scaled);
+void resetOrientation();
+unsigned char getHeadingConfidence();
 char determineFace(AccelerometerScaled scaled);
 char oppositeFace(char face);
 
@@ -13,7 +18,7 @@ unsigned char getNose();
 void setNose(unsigned char newnose);
 
 //Game helpers
-boolean pointingCorrectly(int leeway);
+boolean pointingCorrectly(int leeway, unsigned char minconfidence = 0);
 boolean magneticallyPacified(HMC5883L compass);
 
 //Animation helper functions
@@ -25,4 +30,9 @@ unsigned char anticlockwise(unsigned char side);
 
 extern int cached_bearing;
 
-#endif
+//Magnetometer calibration (config.mag_calibration): 3 hard iron offsets (scaled units)
+//then 3 soft iron axis scales in fixed point, where MAG_SCALE_ONE is 1.0
+#define MAG_SCALE_ONE 4096
+void fit_mag_calibration(const int *mins, const int *maxs, int16_t *buf);
+
+#endif
@@ -0,0 +1,179 @@
+#include "Arduino.h"
+#include "options.h"
+#include "config.h"
+#include "compass.h"
+#include "leds.h"
+#include <EEPROM.h>
+#include <util/crc16.h>
+#include <stddef.h>
+
+/*
+ * Configuration store.
+ *
+ * The configuration is kept as a CRC protected record. Records are written to a ring of
+ * CONFIG_SLOTS slots at the start of the EEPROM, each save going into the slot after the
+ * newest one, so rewrites are spread across CONFIG_SLOTS times as many cells. A save that
+ * is interrupted part way leaves a record with a bad CRC, and the previous record is used.
+ *
+ * At startup every slot is checked once and the valid record with the newest sequence
+ * number is loaded, so loading always takes the same bounded time.
+ *
+ * Older records were a prefix of the current layout followed by the CRC. Version 1 ended
+ * after the behaviour timings, in a ring of 16 slots of 40 bytes over the same EEPROM, and
+ * version 2 after the LED scales, in the current ring. If there is no current record the
+ * newest older one is loaded instead, with the fields it lacked at their defaults.
+ */
+
+//Address of the bearing in the layout used before the configuration record
+#define LEGACY_BEARING_ADDR 0
+
+#define V1_SLOT_SIZE 40
+#define V1_SLOTS 16
+#define V1_FIELDS offsetof(ConfigRecord, led_scale)
+#define V2_FIELDS offsetof(ConfigRecord, bandgap_mv)
+
+//Fails to compile if the record has outgrown its slot
+typedef char config_fits_slot[(sizeof(ConfigRecord) <= CONFIG_SLOT_SIZE) ? 1 : -1];
+
+ConfigRecord config;
+
+//Which slot holds the current record (or -1 if none)
+static signed char current_slot = -1;
+
+static unsigned int crc_bytes(ConfigRecord *c, unsigned char len) {
+	unsigned int crc = 0xFFFF;
+	unsigned char *p = (unsigned char *) c;
+
+	for(unsigned char i = 0; i < len; i++) {
+		crc = _crc_ccitt_update(crc, p[i]);
+	}
+	return crc;
+}
+
+//Everything but the CRC itself
+static unsigned int config_crc(ConfigRecord *c) {
+	return crc_bytes(c, sizeof(ConfigRecord) - sizeof(c->crc));
+}
+
+static void read_bytes(int addr, void *dest, unsigned char len) {
+	unsigned char *p = (unsigned char *) dest;
+
+	for(unsigned char i = 0; i < len; i++) {
+		p[i] = EEPROM.read(addr + i);
+	}
+}
+
+static void read_slot(unsigned char slot, ConfigRecord *c) {
+	read_bytes(CONFIG_RING_START + slot * CONFIG_SLOT_SIZE, c, sizeof(ConfigRecord));
+}
+
+//Load the newest valid record of an older version into config, returning false if there is none
+static boolean load_old_config(unsigned char version, unsigned char slot_size, unsigned char slots, unsigned char fields) {
+	ConfigRecord c;
+	boolean found = false;
+
+	for(unsigned char slot = 0; slot < slots; slot++) {
+		int addr = CONFIG_RING_START + slot * slot_size;
+		read_bytes(addr, &c, fields);
+		read_bytes(addr + fields, &c.crc, sizeof(c.crc));
+		if(c.version != version || c.crc != crc_bytes(&c, fields)) continue;
+
+		if(!found || (signed char)(c.sequence - config.sequence) > 0) {
+			default_config(&config);
+			memcpy(&config, &c, fields);
+			found = true;
+		}
+	}
+	return found;
+}
+
+void default_config(ConfigRecord *c) {
+	c->version = CONFIG_VERSION;
+	c->sequence = 0;
+	c->bearing = 0;
+
+	//Measured on the cube and found to be stable
+	c->acc_calibration[0] = 12;
+	c->acc_calibration[1] = 12;
+	c->acc_calibration[2] = 24;
+
+	//No magnetometer correction
+	for(unsigned char i = 0; i < 3; i++) {
+		c->mag_calibration[i] = 0;
+		c->mag_calibration[3 + i] = MAG_SCALE_ONE;
+	}
+
+	c->nose_anims_min = DEFAULT_ANIMS_BETWEEN_NOSE_CHANGES_MIN;
+	c->nose_anims_max = DEFAULT_ANIMS_BETWEEN_NOSE_CHANGES_MAX;
+	c->anim_gap_min = DEFAULT_TIME_BETWEEN_ANIMS_8SECS_MIN;
+	c->anim_gap_max = DEFAULT_TIME_BETWEEN_ANIMS_8SECS_MAX;
+	c->apoplexy_threshold = DEFAULT_APOPLEXY_THRESHOLD;
+	c->apoplexy_sleep = DEFAULT_APOPLEXY_SLEEP_8SECS;
+	c->vibrate_threshold = DEFAULT_VIBRATE_THRESHOLD;
+
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		for(unsigned char ch = 0; ch < 3; ch++) c->led_scale[i][ch] = LED_SCALE_ONE;
+	}
+
+	c->bandgap_mv = BANDGAP_MV;
+}
+
+/*
+ * Load the newest valid record into config.
+ * If there is none, config is set from an older record, or failing that to the defaults
+ * (keeping the bearing from the old single byte layout if there is one), and false is returned.
+ */
+boolean load_config() {
+	ConfigRecord c;
+	current_slot = -1;
+
+	for(unsigned char slot = 0; slot < CONFIG_SLOTS; slot++) {
+		read_slot(slot, &c);
+		if(c.version != CONFIG_VERSION || c.crc != config_crc(&c)) continue;
+
+		//Sequence numbers wrap, so compare them by their difference
+		if(current_slot == -1 || (signed char)(c.sequence - config.sequence) > 0) {
+			config = c;
+			current_slot = slot;
+		}
+	}
+
+	if(current_slot == -1) {
+		if(load_old_config(2, CONFIG_SLOT_SIZE, CONFIG_SLOTS, V2_FIELDS)) return false;
+		if(load_old_config(1, V1_SLOT_SIZE, V1_SLOTS, V1_FIELDS)) return false;
+
+		unsigned char legacy = EEPROM.read(LEGACY_BEARING_ADDR);
+		default_config(&config);
+		if(legacy < 0xFF) config.bearing = legacy;
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Save config into the next slot of the ring.
+ * Only bytes that differ from what is already in the slot are written.
+ */
+void save_config() {
+	unsigned char *p = (unsigned char *) &config;
+	unsigned char slot = (current_slot + 1) % CONFIG_SLOTS;
+	int addr = CONFIG_RING_START + slot * CONFIG_SLOT_SIZE;
+
+	config.version = CONFIG_VERSION;
+	config.sequence++;
+	config.crc = config_crc(&config);
+
+	for(unsigned char i = 0; i < sizeof(ConfigRecord); i++) {
+		if(EEPROM.read(addr + i) != p[i]) EEPROM.write(addr + i, p[i]);
+	}
+	current_slot = slot;
+}
+
+//Erase every stored record and go back to the defaults
+void clear_config() {
+	for(int addr = CONFIG_RING_START; addr < CONFIG_RING_END; addr++) {
+		if(EEPROM.read(addr) != 0xFF) EEPROM.write(addr, 0xFF);
+	}
+	current_slot = -1;
+	default_config(&config);
+}
@@ -0,0 +1,52 @@
+#ifndef __CONFIG_H_
+#define __CONFIG_H_
+
+#include "options.h"
+
+//Bump this whenever the layout of ConfigRecord changes
+#define CONFIG_VERSION 3
+
+//EEPROM used by the configuration ring. Everything from CONFIG_RING_END up is free for other uses.
+#define CONFIG_SLOT_SIZE 64 //Must be at least sizeof(ConfigRecord)
+#define CONFIG_SLOTS 10
+#define CONFIG_RING_START 0
+#define CONFIG_RING_END (CONFIG_RING_START + CONFIG_SLOT_SIZE * CONFIG_SLOTS)
+
+/*
+ * Everything the cube keeps in EEPROM. Behaviour timings default to the values in options.h
+ * but can be changed at runtime and saved.
+ * The fields have fixed widths so that the layout is the same when built for the host checks.
+ */
+typedef struct _config {
+	unsigned char version;
+	unsigned char sequence; //Incremented on each save, so the newest record can be found
+	int16_t bearing;
+	int16_t acc_calibration[3];
+	int16_t mag_calibration[6]; //See MAG_SCALE_ONE in compass.h
+
+	//Behaviour timings
+	uint16_t nose_anims_min; //Animations between nose changes
+	uint16_t nose_anims_max;
+	uint16_t anim_gap_min; //Time between animations, in 8 second sleeps
+	uint16_t anim_gap_max;
+	uint16_t apoplexy_threshold; //In animation ticks
+	uint16_t apoplexy_sleep; //In 8 second sleeps
+	uint16_t vibrate_threshold; //In animation ticks
+
+	//White balance: scale of each LED's red, green and blue, where LED_SCALE_ONE is unchanged (see leds.cpp)
+	unsigned char led_scale[NUMLEDS][3];
+
+	//This part's bandgap in mV, which the supply is measured against (see battery.cpp)
+	uint16_t bandgap_mv;
+
+	uint16_t crc;
+} ConfigRecord;
+
+extern ConfigRecord config;
+
+void default_config(ConfigRecord *c);
+boolean load_config();
+void save_config();
+void clear_config();
+
+#endif
@@ -0,0 +1,82 @@
+#include "Arduino.h"
+#include "entropy.h"
+
+/*
+ * Hardware entropy pool and a fast PRNG to replace Arduino's random().
+ *
+ * Sensor noise is biased (for the accelerometer LSBs 0 dominates), so bits pass through a
+ * von Neumann filter before going into the pool: they are taken in pairs, 01 gives 0, 10
+ * gives 1, and 00 and 11 are discarded. Each time 32 debiased bits are collected they are
+ * mixed into the PRNG state.
+ *
+ * The PRNG is xorshift32, which needs only shifts and XORs. Ranges are reduced by
+ * multiplying and taking the high bits, so no calls need a division.
+ */
+
+static uint32_t prng_state = 2463534242UL; //Any non-zero value
+static uint32_t pool = 0;
+static unsigned char poolbits = 0;
+static unsigned char pending = 0xFF; //First bit of the current pair, or 0xFF if none
+
+//Add one raw (possibly biased) bit to the entropy pool
+void entropy_add_bit(unsigned char bit) {
+	bit &= 1;
+
+	if(pending == 0xFF) {
+		pending = bit;
+		return;
+	}
+
+	if(pending != bit) {
+		pool = (pool << 1) | pending;
+		poolbits++;
+		if(poolbits >= 32) {
+			random_seed(prng_state ^ pool);
+			poolbits = 0;
+		}
+	}
+	pending = 0xFF;
+}
+
+//Add the least significant bit of each axis of a sensor snapshot to the entropy pool
+void entropy_add_sample(int x, int y, int z) {
+	entropy_add_bit(x);
+	entropy_add_bit(y);
+	entropy_add_bit(z);
+}
+
+//Mix whatever is in the pool into the PRNG now, without waiting for 32 bits
+void entropy_flush() {
+	if(poolbits > 0) {
+		random_seed(prng_state ^ pool);
+		poolbits = 0;
+	}
+}
+
+void random_seed(uint32_t seed) {
+	//xorshift can never leave the all zero state
+	if(seed == 0) seed = 2463534242UL;
+	prng_state = seed;
+}
+
+uint32_t random32() {
+	uint32_t x = prng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	prng_state = x;
+	return x;
+}
+
+//Random number from lo to hi - 1, as Arduino's random(lo, hi)
+//16 random bits are used even for 8 bit ranges, otherwise the low outcomes are noticeably favoured.
+unsigned char random8(unsigned char lo, unsigned char hi) {
+	unsigned int r = random32() >> 16;
+	return lo + (((uint32_t) r * (unsigned char)(hi - lo)) >> 16);
+}
+
+//Random number from lo to hi - 1, as Arduino's random(lo, hi)
+unsigned int random16(unsigned int lo, unsigned int hi) {
+	unsigned int r = random32() >> 16;
+	return lo + (((uint32_t) r * (unsigned int)(hi - lo)) >> 16);
+}
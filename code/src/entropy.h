@@ -0,0 +1,17 @@
+#ifndef __ENTROPY_H_
+#define __ENTROPY_H_
+
+#include <stdint.h>
+
+//Entropy pool
+void entropy_add_bit(unsigned char bit);
+void entropy_add_sample(int x, int y, int z);
+void entropy_flush();
+
+//Fast PRNG
+void random_seed(uint32_t seed);
+uint32_t random32();
+unsigned char random8(unsigned char lo, unsigned char hi);
+unsigned int random16(unsigned int lo, unsigned int hi);
+
+#endif
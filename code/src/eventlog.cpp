@@ -0,0 +1,137 @@
+#include "Arduino.h"
+#include "options.h"
+#include "eventlog.h"
+#include "config.h"
+#include "timekeeping.h"
+#include "telemetry.h"
+#include <EEPROM.h>
+#include <util/crc16.h>
+
+/*
+ * Persistent event log.
+ *
+ * Events are kept in a ring of fixed size entries in the EEPROM above the configuration
+ * ring. Each entry is:
+ *   byte 0   : type in bits 0-6, lap bit in bit 7
+ *   byte 1   : argument
+ *   bytes 2-4: timestamp in 8 second units, little endian (so wraps after ~4 years)
+ *   byte 5   : CRC8 of bytes 0-4
+ *
+ * The lap bit flips each time the ring wraps around, so the oldest entry is found where
+ * it changes between neighbours; no separate head pointer needs to be written. Byte 0 is
+ * written last, so if power is lost during an append the slot keeps its old lap bit and
+ * the next append simply reuses it. A torn entry fails its CRC and is skipped when dumped.
+ *
+ * Dump the log with dump_event_log() and decode it with tools/decode_eventlog.py.
+ */
+
+#define EVENT_SIZE 6
+#define EVENTLOG_START CONFIG_RING_END
+#define EVENTLOG_ENTRIES ((E2END + 1 - EVENTLOG_START) / EVENT_SIZE)
+#define EVENT_TYPE_MASK 0x7F
+#define EVENT_LAP 0x80
+
+static int head = -1; //Next slot to write, or -1 if not yet found
+static unsigned char lap;
+
+static int slot_addr(int slot) {
+	return EVENTLOG_START + slot * EVENT_SIZE;
+}
+
+static unsigned char slot_lap(int slot) {
+	return EEPROM.read(slot_addr(slot)) & EVENT_LAP;
+}
+
+//Find the next slot to write by looking for where the lap bit changes
+static void find_head() {
+	unsigned char first = slot_lap(0);
+
+	for(int slot = 1; slot < EVENTLOG_ENTRIES; slot++) {
+		if(slot_lap(slot) != first) {
+			head = slot;
+			lap = first;
+			return;
+		}
+	}
+
+	//Every slot is on the same lap, so the ring is full (or erased) and starts again at 0
+	head = 0;
+	lap = first ^ EVENT_LAP;
+}
+
+static unsigned char event_crc(unsigned char *e) {
+	unsigned char crc = 0;
+	for(unsigned char i = 0; i < EVENT_SIZE - 1; i++) {
+		crc = _crc8_ccitt_update(crc, e[i]);
+	}
+	return crc;
+}
+
+/*
+ * Append an event to the log, timestamped with the uptime from the virtual clock.
+ * Costs EVENT_SIZE EEPROM byte writes (about 20ms).
+ */
+void log_event(unsigned char type, unsigned char arg) {
+	unsigned char e[EVENT_SIZE];
+	unsigned long t = uptime_seconds() / 8;
+	int addr;
+
+	if(TELEMETRY_ENABLED) telemetry_event(type, arg);
+
+	if(head == -1) find_head();
+	addr = slot_addr(head);
+
+	e[0] = (type & EVENT_TYPE_MASK) | lap;
+	e[1] = arg;
+	e[2] = t;
+	e[3] = t >> 8;
+	e[4] = t >> 16;
+	e[5] = event_crc(e);
+
+	//Write the type byte last, as that commits the entry
+	for(unsigned char i = 1; i < EVENT_SIZE; i++) {
+		EEPROM.write(addr + i, e[i]);
+	}
+	EEPROM.write(addr, e[0]);
+
+	head++;
+	if(head >= EVENTLOG_ENTRIES) {
+		head = 0;
+		lap ^= EVENT_LAP;
+	}
+}
+
+/*
+ * Write the log over the serial line, oldest entry first. Each valid entry is printed
+ * as one line of hex bytes between "EVENTLOG" and "END" lines.
+ */
+void dump_event_log() {
+	if(head == -1) find_head();
+
+	Serial.println(F("EVENTLOG"));
+	for(int i = 0; i < EVENTLOG_ENTRIES; i++) {
+		unsigned char e[EVENT_SIZE];
+		int addr = slot_addr((head + i) % EVENTLOG_ENTRIES);
+
+		for(unsigned char b = 0; b < EVENT_SIZE; b++) {
+			e[b] = EEPROM.read(addr + b);
+		}
+		if((e[0] & EVENT_TYPE_MASK) == EVENT_TYPE_MASK || e[5] != event_crc(e)) continue; //Erased or torn
+
+		for(unsigned char b = 0; b < EVENT_SIZE; b++) {
+			if(e[b] < 0x10) Serial.print('0');
+			Serial.print(e[b], HEX);
+			Serial.print(' ');
+		}
+		Serial.println();
+	}
+	Serial.println(F("END"));
+}
+
+void clear_event_log() {
+	for(int addr = EVENTLOG_START; addr < slot_addr(EVENTLOG_ENTRIES); addr++) {
+		if(EEPROM.read(addr) != 0xFF) EEPROM.write(addr, 0xFF);
+	}
+	head = 0;
+	lap = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef __EVENTLOG_H_
+#define __EVENTLOG_H_
+
+//Event types. Values must stay below 0x7F and must not be reused, as the host decoder relies on them.
+#define EVENT_BOOT 1
+#define EVENT_UNHAPPY 2 //Started an unhappy episode
+#define EVENT_CALMED 3 //Unhappy episode ended. arg: duration in seconds (saturates at 255)
+#define EVENT_APOPLEXY 4 //Gave up and went into apoplectic sleep
+//5 was the end of apoplexy in 8 second sleeps, which saturated. No longer logged.
+#define EVENT_PACIFIED 6 //A pacification magnet was found
+#define EVENT_SENSOR_RETRIES 7 //Sensor bring-up needed retries. arg: attempts made
+#define EVENT_NOSE_CHANGE 8 //arg: the new nose
+#define EVENT_BATTERY_FLAT 9 //The battery reached BATTERY_FLAT_MV. arg: supply in 20mV units
+#define EVENT_APOPLEXY_ENDED 10 //arg: minutes spent apoplectic (saturates at 255, over 4 hours)
+
+void log_event(unsigned char type, unsigned char arg);
+void dump_event_log();
+void clear_event_log();
+
+#endif
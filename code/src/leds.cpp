@@ -1,26 +1,65 @@
 #include "Arduino.h"
 #include "options.h"
 #include "leds.h"
+#include "ledscanner.h"
 #include "TimerOne.h"
+#include "peripherals.h"
+#include "config.h"
+#include <avr/pgmspace.h>
 
-const unsigned char pins[NUMLEDS] = LED_ANODE_PINS;
+//The scanner for this board's wiring, from options.h
+typedef LedScanner<LED_ANODES, LED_CATHODES, LED_SCANMAX, LED_SCANNER_RATE_US, LED_GROUP_MAX> Scanner;
 
-//The 'frame buffer'
-Colour ledbuffer[NUMLEDS];
+//Fails to compile if the wiring does not have NUMLEDS anodes
+typedef char anode_count_matches_numleds[(Scanner::count == NUMLEDS) ? 1 : -1];
+
+//Perceived brightness (0 to 255) to light output, round(255 * (i / 255) ^ 2.2)
+static const unsigned char gamma8[256] PROGMEM = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2,
+	3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6,
+	6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10, 11, 11, 11, 12,
+	12, 13, 13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18, 19, 19,
+	20, 20, 21, 22, 22, 23, 23, 24, 25, 25, 26, 26, 27, 28, 28, 29,
+	30, 30, 31, 32, 33, 33, 34, 35, 35, 36, 37, 38, 39, 39, 40, 41,
+	42, 43, 43, 44, 45, 46, 47, 48, 49, 49, 50, 51, 52, 53, 54, 55,
+	56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
+	73, 74, 75, 76, 77, 78, 79, 81, 82, 83, 84, 85, 87, 88, 89, 90,
+	91, 93, 94, 95, 97, 98, 99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+	113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+	137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+	163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+	192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+	223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+};
+
+//Longest the end of cycle work (fades and dithering) has taken since the scanner started, in microseconds
+static volatile unsigned int cycle_us = 0;
+
+static volatile unsigned char fading = 0; //Bit per LED with a fade running
+static void step_fades();
 
 //Set the pin modes and values that we need
 void initialise_leds() {  
-	for(unsigned char i = 0; i < NUMLEDS; i++) {
-		pinMode(pins[i], OUTPUT);
-		digitalWrite(pins[i], LOW);
-	}
+	Scanner::initialise();
 }
 
+static boolean scanner_running = false;
+
+//Timer1 TOP for a single slot of the scanner
+static unsigned int slot_top;
+
 //Attach timer interrupt to begin LED scanning
 void start_led_scanner() {
 #ifdef USE_LED_SCANNER
+	if(!scanner_running) {
+		peripheral_acquire(PERIPH_TIMER1);
+		cycle_us = 0;
+	}
+	scanner_running = true;
 	initialise_leds();
-	Timer1.initialize(LED_SCANNER_RATE_US);
+	Timer1.initialize(Scanner::rate_us);
+	slot_top = ICR1;
 	Timer1.attachInterrupt(next_led_subscan);
 #endif
 }
@@ -30,82 +69,268 @@ void stop_led_scanner() {
 #ifdef USE_LED_SCANNER
 	Timer1.stop();
 	turnOffLEDs();
+	if(scanner_running) peripheral_release(PERIPH_TIMER1);
+	scanner_running = false;
 #endif
 }
 
-//Drive colour pins to 0 to assert, or set to input mode to deassert
-//Ensures we do not accidentally drive the LEDs backwards (asserting the colour pins to 1 and the anodes to 0)
-void assertColourPin(unsigned char pinnum, boolean assert) {
-	if(assert) {
-		pinMode(pinnum, OUTPUT);
-	} else {
-		pinMode(pinnum, INPUT);
-	}
-}
-
 
 /*
- * LED scanner with software PWM. Each time this function is called the scanner
- * moves along to the next LED. After scanning the full array of LEDs, it moves
- * back to the start and incremements its scanlevel, which is a variable from 0
- * to LED_SCANMAX. For each LED, its colour channel will be asserted iff the
- * associated colour value in the 'frame buffer' is lower than the current
- * scanlevel.
+ * LED scanner with software PWM, called from the Timer1 interrupt. Each call lights the next
+ * group of LEDs which share a colour at the current scan level, or leaves them all dark for
+ * the rest of the level. For each LED, its colour channel will be asserted iff the associated
+ * colour value in the 'frame buffer' is higher than the current scan level. See ledscanner.h.
  *
- * This scanner must be called repeatedly and as close to periodically as
- * possible.
+ * The timer period is set to however many slots the step lasts, so the dark part of each level
+ * takes one interrupt. The interrupt comes at BOTTOM and the counter has only just started
+ * back up, so TOP can safely be moved here.
  */
 void next_led_subscan() {
-	static unsigned char previousled = NUMLEDS - 1;
-	static unsigned char scanpos = 0; //Which LED are we currently scanning
-	static unsigned char scanlevel = 0; //For software PWM. LED will be lit if its color value is higher than this variable.
+	bool cycle_end;
+	unsigned char slots;
 
 	interrupts();
+	slots = Scanner::subscan(cycle_end);
 
-	//Deassert the previous anode
-	digitalWrite(pins[previousled], LOW);
+	noInterrupts();
+	ICR1 = slot_top * slots;
+	interrupts();
 
-	//Set up the colour for the next LED
-	assertColourPin(RED_PIN, (scanlevel < ledbuffer[scanpos].r));
-	assertColourPin(GREEN_PIN, (scanlevel < ledbuffer[scanpos].g));
-	assertColourPin(BLUE_PIN, (scanlevel < ledbuffer[scanpos].b));
+	if(cycle_end && (fading || Scanner::is_dithered())) {
+		unsigned long start;
+		unsigned int us;
 
-	//Activate the current anode
-	digitalWrite(pins[scanpos], HIGH);
+		//This can outlast a slot, so stop the scanner interrupting itself meanwhile
+		TIMSK1 &= ~_BV(TOIE1);
+		start = micros();
 
-	//Advance
-	previousled = scanpos;
-	scanpos++;
-	if(scanpos >= NUMLEDS) {
-		scanpos = 0;
-		scanlevel++;
-		if(scanlevel == LED_SCANMAX) scanlevel = 0;
+		if(fading) step_fades();
+		if(Scanner::is_dithered()) Scanner::dither();
+
+		us = micros() - start;
+		if(us > cycle_us) cycle_us = us;
+		TIMSK1 |= _BV(TOIE1);
 	}
 }
 
+unsigned int led_cycle_us() {
+	return cycle_us;
+}
+
 
 void setLED(unsigned char led, unsigned char col) {
 	setLED(led, col, col, col);
 }
 
+/*
+ * White balance. Each channel of each LED is scaled by its factor in the configuration as
+ * the LED is set, so the scanner interrupt never sees the factors. Scaled levels generally
+ * fall between the native ones. A native colour (setLED()) is rounded to the nearest native
+ * level, so it costs the interrupt no dithering. An 8 bit colour or a fade is dithered (see
+ * setLED8()), unless its scaled levels all land exactly on native ones. LEDs whose factors
+ * are all LED_SCALE_ONE take native colours straight into the frame buffer as before.
+ */
+static boolean unscaled(unsigned char led) {
+	return config.led_scale[led][0] == LED_SCALE_ONE
+			&& config.led_scale[led][1] == LED_SCALE_ONE
+			&& config.led_scale[led][2] == LED_SCALE_ONE;
+}
+
+static unsigned char scale(unsigned char linear, unsigned char factor) {
+	return ((unsigned int) linear * (factor + 1)) >> 8;
+}
+
+//Native levels above LED_SCANMAX are fully on, as in the scanner
+static unsigned char native_to_linear(unsigned char v) {
+	if(v >= LED_SCANMAX) return 255;
+	return ((unsigned int) v * 256) / LED_SCANMAX;
+}
+
+static unsigned char linear_to_native(unsigned char v) {
+	return ((unsigned int) v * LED_SCANMAX + 0x80) >> 8;
+}
+
+//Does a linear level dither to the same native level every cycle? (see LedScanner::dither_channel())
+static boolean on_native_level(unsigned char linear) {
+	return linear == 255 || (((unsigned int) linear * LED_SCANMAX) & 0xFF) == 0;
+}
+
+//The colour each LED was last given, in 8 bit linear levels before white balance (see getLED())
+static Colour requested[NUMLEDS];
+
+//At the end of a PWM cycle the scanner dithers straight after, so the LED is left for that
+static void set_linear(unsigned char led, Colour c, boolean cycle_end) {
+	requested[led] = c;
+	c.r = scale(c.r, config.led_scale[led][0]);
+	c.g = scale(c.g, config.led_scale[led][1]);
+	c.b = scale(c.b, config.led_scale[led][2]);
+
+	boolean native = on_native_level(c.r) && on_native_level(c.g) && on_native_level(c.b);
+	if(native) {
+		c.r = linear_to_native(c.r);
+		c.g = linear_to_native(c.g);
+		c.b = linear_to_native(c.b);
+	}
+
+	if(native) Scanner::set_native(led, c);
+	else if(cycle_end) Scanner::set_target(led, c);
+	else Scanner::set_linear(led, c);
+}
+
+static void fade_stop(unsigned char led, Colour from);
+
 void setLED(unsigned char led, Colour c) {
-	if(led < NUMLEDS && led >= 0) {
-		ledbuffer[led].r = c.r;
-		ledbuffer[led].g = c.g;
-		ledbuffer[led].b = c.b;
+	Colour black = {0, 0, 0};
+	Colour linear = {native_to_linear(c.r), native_to_linear(c.g), native_to_linear(c.b)};
+
+	if(led >= NUMLEDS) return;
+	fade_stop(led, black);
+	requested[led] = linear;
+	if(!unscaled(led)) {
+		c.r = linear_to_native(scale(linear.r, config.led_scale[led][0]));
+		c.g = linear_to_native(scale(linear.g, config.led_scale[led][1]));
+		c.b = linear_to_native(scale(linear.b, config.led_scale[led][2]));
 	}
+	Scanner::set_native(led, c);
 }
 
 void setLED(unsigned char led, unsigned char r, unsigned char g, unsigned char b) {
-	if(led < NUMLEDS && led >= 0) {
-		ledbuffer[led].r = r;
-		ledbuffer[led].g = g;
-		ledbuffer[led].b = b;
+	Colour c;
+	c.r = r;
+	c.g = g;
+	c.b = b;
+	setLED(led, c);
+}
+
+/*
+ * Set an LED with 8 bits per channel, 0 to 255 on a perceptual scale. The scanner only has
+ * LED_SCANMAX levels, so after gamma correction the level in between is made by dithering:
+ * the LED alternates between the two nearest levels from one PWM cycle to the next.
+ */
+static void set_perceptual(unsigned char led, Colour c, boolean cycle_end) {
+	c.r = pgm_read_byte(&gamma8[c.r]);
+	c.g = pgm_read_byte(&gamma8[c.g]);
+	c.b = pgm_read_byte(&gamma8[c.b]);
+	set_linear(led, c, cycle_end);
+}
+
+void setLED8(unsigned char led, Colour c) {
+	if(led >= NUMLEDS) return;
+	fade_stop(led, c);
+	set_perceptual(led, c, false);
+}
+
+void setLED8(unsigned char led, unsigned char r, unsigned char g, unsigned char b) {
+	Colour c;
+	c.r = r;
+	c.g = g;
+	c.b = b;
+	setLED8(led, c);
+}
+
+/*
+ * Fades. fadeLED8() gives an LED a target colour (8 bits per channel, as setLED8()) and a
+ * duration. At the end of every PWM cycle (about 5ms) the scanner interrupt moves each fading
+ * LED a step closer, so an animation sets a fade once instead of stepping the colour each
+ * TICK_MS. Levels are interpolated in 8.8 fixed point on the perceptual scale and are gamma
+ * corrected and dithered as for setLED8().
+ *
+ * A fade starts from the colour last given by setLED8() or reached by a fade. setLED() stops
+ * any fade on the LED, and fades after it start from black.
+ */
+typedef struct {
+	unsigned int value[3]; //Current level, 8.8 fixed point
+	int step[3]; //Added each PWM cycle, 8.8 fixed point
+	unsigned char target[3];
+	unsigned int cycles; //PWM cycles left
+} Fade;
+
+static Fade fades[NUMLEDS];
+
+static void fade_stop(unsigned char led, Colour from) {
+	unsigned char oldSREG = SREG;
+	cli();
+	fading &= ~(1 << led);
+	fades[led].value[0] = (unsigned int) from.r << 8;
+	fades[led].value[1] = (unsigned int) from.g << 8;
+	fades[led].value[2] = (unsigned int) from.b << 8;
+	SREG = oldSREG;
+}
+
+void fadeLED8(unsigned char led, Colour c, unsigned int ms) {
+	unsigned long cycle = (unsigned long) LED_SCANNER_RATE_US * NUMLEDS * Scanner::period;
+	unsigned int cycles = ((unsigned long) ms * 1000 + cycle / 2) / cycle;
+	unsigned char target[3] = {c.r, c.g, c.b};
+
+	if(led >= NUMLEDS) return;
+	if(cycles < 2) {
+		setLED8(led, c);
+		return;
 	}
+
+	Fade *f = &fades[led];
+	unsigned char oldSREG = SREG;
+	cli();
+	for(unsigned char ch = 0; ch < 3; ch++) {
+		f->target[ch] = target[ch];
+		f->step[ch] = (((long) target[ch] << 8) - f->value[ch]) / (long) cycles;
+	}
+	f->cycles = cycles;
+	fading |= 1 << led;
+	SREG = oldSREG;
+}
+
+void fadeLED8(unsigned char led, unsigned char r, unsigned char g, unsigned char b, unsigned int ms) {
+	Colour c;
+	c.r = r;
+	c.g = g;
+	c.b = b;
+	fadeLED8(led, c, ms);
+}
+
+boolean leds_fading() {
+	return fading != 0;
 }
 
+//Called from the scanner interrupt at the end of each PWM cycle
+static void step_fades() {
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		Fade *f = &fades[i];
+		Colour c;
+
+		if(!(fading & (1 << i))) continue;
+		if(--f->cycles == 0) {
+			for(unsigned char ch = 0; ch < 3; ch++) f->value[ch] = (unsigned int) f->target[ch] << 8;
+			fading &= ~(1 << i);
+		} else {
+			for(unsigned char ch = 0; ch < 3; ch++) f->value[ch] += f->step[ch];
+		}
+
+		//Round to the nearest level
+		c.r = (f->value[0] + 0x80) >> 8;
+		c.g = (f->value[1] + 0x80) >> 8;
+		c.b = (f->value[2] + 0x80) >> 8;
+		set_perceptual(i, c, true);
+	}
+}
+
+/*
+ * The colour an LED was asked for, in native levels: not the frame buffer, which holds this
+ * PWM cycle's dithered level, or the level after white balance. An 8 bit colour or a fade is
+ * rounded to the nearest native level, and a native level above LED_SCANMAX reads back as
+ * LED_SCANMAX, which is just as bright.
+ */
 Colour getLED(unsigned char led) {
-	return ledbuffer[led];
+	Colour c;
+	unsigned char oldSREG = SREG;
+
+	cli(); //Fades move it from the scanner interrupt
+	c = requested[led];
+	SREG = oldSREG;
+	c.r = linear_to_native(c.r);
+	c.g = linear_to_native(c.g);
+	c.b = linear_to_native(c.b);
+	return c;
 }
 
 void clearLEDs() {
@@ -114,10 +339,13 @@ void clearLEDs() {
 	}
 }
 
+//Dim all LEDs to LED_SCANMAX / period of full brightness without losing colour resolution
+void set_led_scan_period(unsigned char period) {
+	if(period < Scanner::levels) period = Scanner::levels;
+	Scanner::period = period;
+}
+
 void turnOffLEDs() {
-	for(int i = 0; i < NUMLEDS; i++) digitalWrite(pins[i], LOW);
-	pinMode(RED_PIN, INPUT);
-	pinMode(GREEN_PIN, INPUT);
-	pinMode(BLUE_PIN, INPUT);
+	Scanner::release();
 }
-
+
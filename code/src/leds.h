@@ -7,6 +7,9 @@ typedef struct _color {
   unsigned char b;
 } Colour;
 
+//White balance scale factor (see ConfigRecord) which leaves a channel unchanged
+#define LED_SCALE_ONE 255
+
 void initialise_leds();
 void next_led_subscan();
 
@@ -15,10 +18,22 @@ Colour getLED(unsigned char led);
 void setLED(unsigned char led, Colour c);
 
 void setLED(unsigned char led, unsigned char r, unsigned char g, unsigned char b);
+
+//8 bits per channel, gamma corrected and dithered (see leds.cpp)
+void setLED8(unsigned char led, Colour c);
+void setLED8(unsigned char led, unsigned char r, unsigned char g, unsigned char b);
+
+//Fade from the current colour to an 8 bit one over ms milliseconds, run by the scanner
+void fadeLED8(unsigned char led, Colour c, unsigned int ms);
+void fadeLED8(unsigned char led, unsigned char r, unsigned char g, unsigned char b, unsigned int ms);
+boolean leds_fading();
+unsigned int led_cycle_us();
+
 void clearLEDs();
 void turnOffLEDs();
+void set_led_scan_period(unsigned char period);
 
 void start_led_scanner();
 void stop_led_scanner();
 
-#endif
+#endif
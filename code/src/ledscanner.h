@@ -0,0 +1,310 @@
+#ifndef __LEDSCANNER_H
+#define __LEDSCANNER_H
+
+#include "Arduino.h"
+#include "leds.h"
+
+/*
+ * The LED scanner (see leds.cpp) as a template over the wiring.
+ *
+ * Pins are types rather than numbers, so every port address and bit mask is a constant
+ * and a pin write compiles to a single sbi/cbi, where digitalWrite() looks both up in
+ * flash tables each call. The LED count is a constant too, which bounds the scan loop.
+ * The wiring is chosen in options.h (LED_ANODES and LED_CATHODES), so another board
+ * needs only a different list there.
+ *
+ * The pin type is a parameter of the list, so swapping AvrPin for MockPin gives a
+ * scanner which records pin states instead of touching the hardware, for host builds.
+ * tools/hostcheck/check_scanner.cpp runs the cube's wiring that way.
+ *
+ * The toolchain is C++03, so lists are nested PinList types rather than variadic.
+ */
+
+//An Arduino pin number on the ATmega328 (0-7 on port D, 8-13 on B, A0-A5 on C)
+template<unsigned char Pin> struct AvrPin {
+	enum { mask = 1 << (Pin < 8 ? Pin : (Pin < 14 ? Pin - 8 : Pin - 14)) };
+	static volatile uint8_t &port() { return Pin < 8 ? PORTD : (Pin < 14 ? PORTB : PORTC); }
+	static volatile uint8_t &ddr() { return Pin < 8 ? DDRD : (Pin < 14 ? DDRB : DDRC); }
+
+	static void high() { port() |= mask; }
+	static void low() { port() &= ~mask; }
+	static void output() { ddr() |= mask; }
+	static void input() { ddr() &= ~mask; }
+};
+
+//A pin for host builds which only records its state
+template<unsigned char Pin> struct MockPin {
+	static bool level; //Driven high
+	static bool driven; //Output rather than input
+
+	static void high() { level = true; }
+	static void low() { level = false; }
+	static void output() { driven = true; }
+	static void input() { driven = false; }
+};
+template<unsigned char Pin> bool MockPin<Pin>::level = false;
+template<unsigned char Pin> bool MockPin<Pin>::driven = false;
+
+//The end of a pin list
+struct PinListEnd {
+	enum { count = 0 };
+	static void high_mask(unsigned char) {}
+	static void all_output() {}
+	static void all_low() {}
+};
+
+//A list of pins. Each pin is a constant, so these unroll into one sbi or cbi per pin.
+template<class Pin, class Next = PinListEnd> struct PinList {
+	enum { count = 1 + Next::count };
+
+	//Drive high the pins whose bits are set in mask, the first pin being bit 0
+	static void high_mask(unsigned char mask) { if(mask & 1) Pin::high(); Next::high_mask(mask >> 1); }
+	static void all_output() { Pin::output(); Next::all_output(); }
+	static void all_low() { Pin::low(); Next::all_low(); }
+};
+
+//Six pins, as there are six faces
+template<class A, class B, class C, class D, class E, class F>
+struct Pins6 : PinList<A, PinList<B, PinList<C, PinList<D, PinList<E, PinList<F> > > > > > {};
+
+//The common cathodes
+template<class R, class G, class B> struct RgbPins {
+	typedef R Red;
+	typedef G Green;
+	typedef B Blue;
+};
+
+/*
+ * Scanner with software PWM. Levels is full brightness, RateUs the length of a slot. Each PWM
+ * level is count slots long, then the scan level goes up by one, wrapping at period. A colour
+ * channel is lit iff its value is above the scan level.
+ *
+ * At the start of each level the frame buffer is compiled into groups: LEDs which need the same
+ * cathodes at this level are lit together, up to MaxGroup of them (every anode in a group sinks
+ * through the same cathode pins, so this bounds the current of each). Each group is lit for one
+ * slot, so every LED is on for exactly as long as when they were scanned one by one, and the
+ * slots left over are dark. subscan() runs one step and returns how many slots it lasts: one for
+ * a group, or the whole dark remainder at once, so a level takes one call per group plus one
+ * rather than count calls.
+ *
+ * LEDs set with set_linear() take 8 bits per channel (0 to 255, linear in light output) and are
+ * temporally dithered: dither() runs once per PWM cycle and picks the native level of each
+ * channel, carrying the remainder over to the next cycle, so that on average the LED shows
+ * the fractional level. LEDs set directly in buffer[] with set_native() are left alone.
+ */
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+class LedScanner {
+public:
+	enum { count = Anodes::count, levels = Levels };
+	static const unsigned long rate_us = RateUs;
+
+	//The 'frame buffer'
+	static Colour buffer[count];
+
+	//Scan levels per PWM cycle, at least Levels. Levels beyond Levels - 1 are always dark, which dims every LED.
+	static volatile unsigned char period;
+
+	/*
+	 * Setting an LED. Each of these may be called with the scanner running, from the main
+	 * program or from its interrupt (fades set LEDs at the end of a PWM cycle), so each runs
+	 * with interrupts off: an interrupt between reading and writing back the dithered mask
+	 * would lose the bit it set for another LED, and one part way through a colour would dither
+	 * or show a half set LED.
+	 */
+
+	//Set an LED in native levels (0 to Levels) and stop dithering it
+	static void set_native(unsigned char led, Colour c) {
+		unsigned char oldSREG = SREG;
+		cli();
+		dithered &= ~(1 << led);
+		buffer[led] = c;
+		SREG = oldSREG;
+	}
+
+	//Set an LED in 8 bit linear levels, dithered from the next PWM cycle on
+	static void set_linear(unsigned char led, Colour c) {
+		unsigned char oldSREG = SREG;
+		cli();
+		target[led] = c;
+		buffer[led].r = dither_channel(c.r, error[led].r);
+		buffer[led].g = dither_channel(c.g, error[led].g);
+		buffer[led].b = dither_channel(c.b, error[led].b);
+		dithered |= (1 << led);
+		SREG = oldSREG;
+	}
+
+	//Set an LED in 8 bit linear levels, leaving this cycle's levels alone for the next dither()
+	//to replace. For the end of a PWM cycle, just before dither(): set_linear() there would dither
+	//the LED twice in one cycle, skipping every other level of its sequence.
+	static void set_target(unsigned char led, Colour c) {
+		unsigned char oldSREG = SREG;
+		cli();
+		target[led] = c;
+		dithered |= (1 << led);
+		SREG = oldSREG;
+	}
+
+	static Colour get_linear(unsigned char led) {
+		return target[led];
+	}
+
+	static bool is_dithered() {
+		return dithered != 0;
+	}
+
+	//Choose the native level of every dithered channel for the next PWM cycle
+	static void dither() {
+		for(unsigned char i = 0; i < count; i++) {
+			if(!(dithered & (1 << i))) continue;
+			buffer[i].r = dither_channel(target[i].r, error[i].r);
+			buffer[i].g = dither_channel(target[i].g, error[i].g);
+			buffer[i].b = dither_channel(target[i].b, error[i].b);
+		}
+	}
+
+	//Drive the anodes low and release the cathodes
+	static void initialise() {
+		Anodes::all_low();
+		Anodes::all_output();
+		release();
+	}
+
+	//Turn every LED off
+	static void release() {
+		Anodes::all_low();
+		Cathodes::Red::low();
+		Cathodes::Green::low();
+		Cathodes::Blue::low();
+		Cathodes::Red::input();
+		Cathodes::Green::input();
+		Cathodes::Blue::input();
+	}
+
+	//Run one step of the scan. Returns the number of slots until the next call, and sets
+	//cycle_end at the end of each PWM cycle.
+	static unsigned char subscan(bool &cycle_end) {
+		unsigned char slots = 1;
+
+		cycle_end = false;
+		if(!compiled) compile_level();
+
+		//Deassert the previous group
+		Anodes::all_low();
+
+		if(step < groups) {
+			//Set up the colour for the next group and activate its anodes
+			cathode<typename Cathodes::Red>(group_state[step] & 1);
+			cathode<typename Cathodes::Green>(group_state[step] & 2);
+			cathode<typename Cathodes::Blue>(group_state[step] & 4);
+			Anodes::high_mask(group_anodes[step]);
+			step++;
+			used++;
+		} else {
+			//Dark for the rest of the level
+			slots = count - used;
+			used = count;
+		}
+
+		//Advance. The next level is compiled on the next call, after any dither().
+		if(used >= count) {
+			used = 0;
+			step = 0;
+			compiled = false;
+			level++;
+			if(level >= period) {
+				level = 0;
+				cycle_end = true;
+			}
+		}
+		return slots;
+	}
+
+private:
+	static unsigned char level; //LED will be lit if its colour value is higher than this
+	static bool compiled; //Groups are up to date for this level
+	static unsigned char groups; //Number of groups at this level
+	static unsigned char step; //The next group to light
+	static unsigned char used; //Slots of this level used so far
+	static unsigned char group_state[count]; //Cathodes of each group, red bit 0, green 1, blue 2
+	static unsigned char group_anodes[count]; //Anodes of each group, LED 0 bit 0
+
+	//Group the LEDs lit at this level by the cathodes they need, at most MaxGroup to a group
+	static void compile_level() {
+		unsigned char size[count];
+
+		groups = 0;
+		for(unsigned char i = 0; i < count; i++) {
+			unsigned char state = (level < buffer[i].r ? 1 : 0) | (level < buffer[i].g ? 2 : 0) | (level < buffer[i].b ? 4 : 0);
+			unsigned char g = 0;
+
+			if(state == 0) continue;
+			while(g < groups && (group_state[g] != state || size[g] >= MaxGroup)) g++;
+			if(g == groups) {
+				group_state[g] = state;
+				group_anodes[g] = 0;
+				size[g] = 0;
+				groups++;
+			}
+			group_anodes[g] |= 1 << i;
+			size[g]++;
+		}
+		compiled = true;
+	}
+
+	static Colour target[count]; //Linear levels of the dithered LEDs
+	static Colour error[count]; //Remainder carried to the next cycle, in 256ths of a level
+	static volatile unsigned char dithered; //Bit per LED, so there can be at most 8 (as for group_anodes)
+
+	//Levels is a constant, so the multiply is a shift for the usual power of two
+	static unsigned char dither_channel(unsigned char linear, unsigned char &err) {
+		if(linear == 255) return Levels; //Fully on, rather than on for 255/256 of the time
+		unsigned int v = (unsigned int) linear * Levels + err;
+		err = v & 0xFF;
+		return v >> 8;
+	}
+
+	//Cathodes are held low, so are asserted by driving them and deasserted by tristating them.
+	//This ensures we never drive an LED backwards (cathode 1 and anode 0).
+	template<class Pin> static void cathode(bool assert) {
+		if(assert) Pin::output();
+		else Pin::input();
+	}
+};
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+Colour LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::buffer[LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::count];
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+volatile unsigned char LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::period = Levels;
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+Colour LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::target[LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::count];
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+Colour LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::error[LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::count];
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+volatile unsigned char LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::dithered = 0;
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+unsigned char LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::level = 0;
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+bool LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::compiled = false;
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+unsigned char LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::groups = 0;
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+unsigned char LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::step = 0;
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+unsigned char LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::used = 0;
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+unsigned char LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::group_state[LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::count];
+
+template<class Anodes, class Cathodes, unsigned char Levels, unsigned long RateUs, unsigned char MaxGroup>
+unsigned char LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::group_anodes[LedScanner<Anodes, Cathodes, Levels, RateUs, MaxGroup>::count];
+
+#endif
@@ -1,9 +1,14 @@
 #ifndef __OPTIONS_H_
 #define __OPTIONS_H_
 
+//Debug mode. Streams sensor snapshots as binary telemetry (see telemetry.h) instead of running the normal behaviour.
 #define DEBUG 0
-#define DEBUGp(s) if((DEBUG) >= 1) Serial.print((s))
-#define DEBUGln(s) if((DEBUG) >= 1) Serial.println((s))
+
+//Tokenised log messages (see tokenlog.h), sent with the telemetry
+#define ENABLE_LOGGING
+
+//Interval between telemetry snapshots in debug mode
+#define TELEMETRY_MS 50
 
 //Use the Piezo buzzer
 #define ENABLE_PIEZO
@@ -11,15 +16,47 @@
 //Use the sensor stick
 #define ENABLE_SENSORS
 
+//Play every animation once at boot, writing its frames and notes to the serial line (see capture.h)
+//#define ANIMATION_CAPTURE
+
 //How long is an animation tick (approximately) (very)
 #define TICK_MS 50
 
 //When playing an animation which requires the sensors, what is the (approximate) polling interval
 #define SENSE_MS 150
 
+//Orientation filter. Each sensor snapshot moves the filtered vectors 1/2^ORIENT_FILTER_SHIFT of the way to the new reading.
+#define ORIENT_FILTER_SHIFT 2
+
+//A snapshot agrees with the orientation filter if each accelerometer axis is within this many 1/1024 G
+//and each magnetometer axis within this many scaled units of the filtered value
+#define ORIENT_ACC_TOLERANCE 100
+#define ORIENT_MAG_TOLERANCE 60
+
+//Heading confidence (0-255) needed before a reading counts towards ending an unhappy episode
+#define ORIENT_CONFIDENT 160
+
 //The I2C address of the ADXL345
 #define ADXL345_ADDRESS 0x53
 
+//Output data rate of the accelerometer (and so the rate its FIFO fills), and the matching sample period
+#define ACCEL_DATA_RATE ADXL345_RATE_100HZ
+#define ACCEL_SAMPLE_MS 10
+
+//Sensor bring-up timings. The ADXL345 turns on in 1.1ms and the HMC5883L accepts
+//I2C commands 200us after power is applied.
+#define SENSOR_POWERUP_MS 2
+#define SENSOR_RETRY_MS 10
+
+//Samples averaged by the magnetometer for each measurement (COMPASS_AVERAGE_1 to COMPASS_AVERAGE_8)
+#define COMPASS_AVERAGING COMPASS_AVERAGE_8
+
+//How long the user has to rotate the cube through every orientation during magnetometer calibration
+#define MAG_CALIBRATION_MS 30000
+
+//How long each colour is shown for during LED white balance calibration
+#define LED_CALIBRATION_MS 4000
+
 //Activate the LED scanner
 #define USE_LED_SCANNER
 
@@ -32,9 +69,39 @@
 //Total levels of brightness supported by the scanner (range of usable values is therefore 0 to LED_SCANMAX - 1)
 #define LED_SCANMAX 8
 
+//Most LEDs the scanner lights at once when they show the same colour. Their current all flows
+//through the shared cathode pins, which the ATmega328 rates at 20mA (40mA absolute maximum),
+//so only raise this if the current of that many overdriven LEDs has been measured. 1 scans the
+//LEDs one at a time, which is all that has been measured so far.
+#define LED_GROUP_MAX 1
+
 //The baud rate to use for serial communications
 #define BAUD_RATE 115200
 
+//The serial RX pin. The command shell (see shell.cpp) is served while this is held high by a host.
+//Undriven it floats, so before each of SHELL_ATTACH_SAMPLES samples, SHELL_ATTACH_INTERVAL_US apart,
+//it is pulled low and given SHELL_ATTACH_SETTLE_US for a host to bring it back up.
+#define SHELL_RX_PIN 0
+#define SHELL_ATTACH_SAMPLES 3
+#define SHELL_ATTACH_INTERVAL_US 100
+#define SHELL_ATTACH_SETTLE_US 5
+
+//How often (in 8 second sleeps) the watchdog period is re-measured against the crystal
+#define CLOCK_CALIBRATION_SLEEPS HOURSIN8(1)
+
+//Battery monitor. The supply is measured against the internal bandgap (nominally BANDGAP_MV) every BATTERY_SAMPLE_SECS.
+//Behaviour is scaled back from BATTERY_GOOD_MV downwards and is as frugal as it gets at BATTERY_FLAT_MV.
+//The 4xAA pack feeds a 5V regulator, so Vcc only starts to fall once the pack is into regulator dropout
+//(around 1.3V per cell), and is roughly 4V when the cells are spent at 1V each.
+//BANDGAP_MV is only the nominal bandgap. Parts range from BANDGAP_MIN_MV to BANDGAP_MAX_MV, which moves every
+//threshold by up to 10%, so each cube's own bandgap is measured with the shell's "cal vcc" and kept in config.
+#define BANDGAP_MV 1100
+#define BANDGAP_MIN_MV 1000
+#define BANDGAP_MAX_MV 1200
+#define BATTERY_SAMPLE_SECS 900
+#define BATTERY_GOOD_MV 4900
+#define BATTERY_FLAT_MV 4000
+
 //If the magnitude of any axis of the magnetometer goes above this level then stay in sleep mode
 #define PACIFICATION_THRESHOLD 2500
 
@@ -46,23 +113,47 @@
 #define HOURSIN8(h) (((h)*60*60)/8)
 #define ANIMATIONSECS(s) ((1000/TICK_MS) * (s))
 
+//These timings are the defaults for the configuration record (see config.h), which may
+//be changed at runtime. Ranges are min to max - 1, and min == max gives a fixed value.
+
 //Proper timings
-#define BEHAVIOUR_ANIMS_BETWEEN_NOSE_CHANGES random(12, 24)
-#define BEHAVIOUR_TIME_BETWEEN_ANIMS_8SECS random(HOURSIN8(3), HOURSIN8(4))
-#define BEHAVIOUR_APOPLEXY_THRESHOLD ANIMATIONSECS(120)
-#define BEHAVIOUR_APOPLEXY_SLEEP_8SECS HOURSIN8(4/2)
+#define DEFAULT_ANIMS_BETWEEN_NOSE_CHANGES_MIN 12
+#define DEFAULT_ANIMS_BETWEEN_NOSE_CHANGES_MAX 24
+#define DEFAULT_TIME_BETWEEN_ANIMS_8SECS_MIN HOURSIN8(3)
+#define DEFAULT_TIME_BETWEEN_ANIMS_8SECS_MAX HOURSIN8(4)
+#define DEFAULT_APOPLEXY_THRESHOLD ANIMATIONSECS(120)
+#define DEFAULT_APOPLEXY_SLEEP_8SECS HOURSIN8(4/2)
 
 //Demo timings
-//#define BEHAVIOUR_ANIMS_BETWEEN_NOSE_CHANGES 300
-//#define BEHAVIOUR_TIME_BETWEEN_ANIMS_8SECS 1
-//#define BEHAVIOUR_APOPLEXY_THRESHOLD ANIMATIONSECS(120)
-//#define BEHAVIOUR_APOPLEXY_SLEEP_8SECS 4
+//#define DEFAULT_ANIMS_BETWEEN_NOSE_CHANGES_MIN 300
+//#define DEFAULT_ANIMS_BETWEEN_NOSE_CHANGES_MAX 300
+//#define DEFAULT_TIME_BETWEEN_ANIMS_8SECS_MIN 1
+//#define DEFAULT_TIME_BETWEEN_ANIMS_8SECS_MAX 1
+//#define DEFAULT_APOPLEXY_THRESHOLD ANIMATIONSECS(120)
+//#define DEFAULT_APOPLEXY_SLEEP_8SECS 4
+
+#define DEFAULT_VIBRATE_THRESHOLD ANIMATIONSECS(13)
+
+//The timings in use
+#define BEHAVIOUR_ANIMS_BETWEEN_NOSE_CHANGES random16(config.nose_anims_min, config.nose_anims_max)
+#define BEHAVIOUR_TIME_BETWEEN_ANIMS_8SECS battery_stretch(random16(config.anim_gap_min, config.anim_gap_max))
+#define BEHAVIOUR_APOPLEXY_THRESHOLD ((int) config.apoplexy_threshold)
+#define BEHAVIOUR_APOPLEXY_SLEEP_8SECS ((int) config.apoplexy_sleep)
+#define BEHAVIOUR_VIBRATE_THRESHOLD ((int) config.vibrate_threshold)
 
 //General behaviour
-#define BEHAVIOUR_VIBRATE_THRESHOLD ANIMATIONSECS(13)
 #define BEHAVIOUR_BEARING_LEEWAY 45
 #define BEHAVIOUR_HAPPY_READINGS_REQUIRED 4
 
+//How often (in 8 second sleeps) the orientation is checked while happy or pacified, and while apoplectic
+#define BEHAVIOUR_CHECK_8SECS 1
+#define BEHAVIOUR_APOPLEXY_CHECK_8SECS 2
+
+//While apoplectic, pulse the LEDs red every this many wakes, and wake up fully if any
+//magnetometer axis has moved by more than BEHAVIOUR_POKE_THRESHOLD since going to sleep
+#define BEHAVIOUR_APOPLEXY_PULSE_WAKES 5
+#define BEHAVIOUR_POKE_THRESHOLD 20
+
 
 //PIN definitions
 //---------------------------------------------------------------------------------
@@ -70,6 +161,9 @@
 //Sensor stick Vcc pin
 #define PIN_SENSOR_POWER A3
 
+//If the magnetometer DRDY line is wired up, use it rather than polling the status register
+//#define PIN_COMPASS_DRDY 12
+
 //The enable pin for the vibration motor
 #define VIBRATE_ENABLE 11
 
@@ -84,7 +178,12 @@
 
 //The pin assignments for the anode of each tri-colour LED
 //i.e. The anode of the LED on face 4 is on the fourth pin listed
-//#define LED_ANODE_PINS {7, 6, 5, 4, 3, 2}
-#define LED_ANODE_PINS {3, 2, 5, 4, 6, 7}
+//Pins are types (see ledscanner.h). Host builds define LED_PIN as MockPin.
+#ifndef LED_PIN
+#define LED_PIN AvrPin
+#endif
+//#define LED_ANODES Pins6<LED_PIN<7>, LED_PIN<6>, LED_PIN<5>, LED_PIN<4>, LED_PIN<3>, LED_PIN<2> >
+#define LED_ANODES Pins6<LED_PIN<3>, LED_PIN<2>, LED_PIN<5>, LED_PIN<4>, LED_PIN<6>, LED_PIN<7> >
+#define LED_CATHODES RgbPins<LED_PIN<RED_PIN>, LED_PIN<GREEN_PIN>, LED_PIN<BLUE_PIN> >
 
 #endif
@@ -0,0 +1,84 @@
+#include "Arduino.h"
+#include "options.h"
+#include "peripherals.h"
+#include <avr/power.h>
+
+/*
+ * Peripheral power manager.
+ *
+ * Each on-chip peripheral that the cube uses is reference counted. The first
+ * peripheral_acquire() takes it out of power reduction and the last peripheral_release()
+ * puts it back, so each phase (sensing, animating, sleeping) runs with only the
+ * peripherals it needs clocked. Timer0 is never gated as millis() depends on it.
+ *
+ * A gated peripheral ignores register writes, so it must be acquired before it is
+ * configured (e.g. before Wire.begin() or Serial.begin()) and configured again after
+ * each acquire.
+ */
+
+static unsigned char refcount[PERIPH_COUNT];
+
+static void gate(unsigned char periph, boolean on) {
+	switch(periph) {
+	case PERIPH_TWI: if(on) power_twi_enable(); else power_twi_disable(); break;
+	case PERIPH_TIMER1: if(on) power_timer1_enable(); else power_timer1_disable(); break;
+	case PERIPH_TIMER2: if(on) power_timer2_enable(); else power_timer2_disable(); break;
+	case PERIPH_USART: if(on) power_usart0_enable(); else power_usart0_disable(); break;
+	case PERIPH_ADC: if(on) power_adc_enable(); else power_adc_disable(); break;
+	}
+}
+
+//Gate everything that nobody holds. SPI is never used so is gated permanently.
+void peripherals_init() {
+	//The Arduino core leaves the ADC enabled. It must be disabled before it is gated, as once
+	//gated it ignores the write and goes on drawing current.
+	ADCSRA = 0;
+	power_spi_disable();
+	for(unsigned char i = 0; i < PERIPH_COUNT; i++) {
+		if(refcount[i] == 0) gate(i, false);
+	}
+}
+
+void peripheral_acquire(unsigned char periph) {
+	if(periph >= PERIPH_COUNT) return;
+	if(refcount[periph]++ == 0) gate(periph, true);
+}
+
+void peripheral_release(unsigned char periph) {
+	if(periph >= PERIPH_COUNT || refcount[periph] == 0) return;
+	if(--refcount[periph] == 0) gate(periph, false);
+}
+
+//Bitmask (1 << PERIPH_x) of the peripherals currently powered
+unsigned char peripherals_active() {
+	unsigned char mask = 0;
+	for(unsigned char i = 0; i < PERIPH_COUNT; i++) {
+		if(refcount[i] > 0) mask |= (1 << i);
+	}
+	return mask;
+}
+
+//-----------------------------------------------------------------------------------
+
+static boolean serial_running = false;
+
+//Power the USART and open the serial port, if it is not already open
+void serial_on() {
+	if(serial_running) return;
+	peripheral_acquire(PERIPH_USART);
+	Serial.begin(BAUD_RATE);
+	serial_running = true;
+}
+
+//Let any pending output go, then close the serial port and gate the USART
+void serial_off() {
+	if(!serial_running) return;
+	Serial.flush();
+	Serial.end();
+	peripheral_release(PERIPH_USART);
+	serial_running = false;
+}
+
+boolean serial_is_on() {
+	return serial_running;
+}
@@ -0,0 +1,21 @@
+#ifndef __PERIPHERALS_H_
+#define __PERIPHERALS_H_
+
+//On-chip peripherals that can be gated through the power reduction register (PRR)
+#define PERIPH_TWI 0
+#define PERIPH_TIMER1 1 //LED scanner
+#define PERIPH_TIMER2 2 //tone()
+#define PERIPH_USART 3
+#define PERIPH_ADC 4
+#define PERIPH_COUNT 5
+
+void peripherals_init();
+void peripheral_acquire(unsigned char periph);
+void peripheral_release(unsigned char periph);
+unsigned char peripherals_active();
+
+void serial_on();
+void serial_off();
+boolean serial_is_on();
+
+#endif
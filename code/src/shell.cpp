@@ -0,0 +1,277 @@
+#include "Arduino.h"
+#include "options.h"
+#include "shell.h"
+#include "config.h"
+#include "compass.h"
+#include "eventlog.h"
+#include "telemetry.h"
+#include "battery.h"
+#include "utils.h"
+#include "peripherals.h"
+#include <avr/pgmspace.h>
+#include <stddef.h>
+
+/*
+ * Serial command shell.
+ *
+ * shell_poll() takes whatever characters have arrived and returns straight away, running a
+ * command once a whole line is in. It never waits for input, so it can be polled from the
+ * scheduler at no cost when nobody is typing. Commands:
+ *
+ *   help
+ *   get [name]              show one or all of the parameters below
+ *   set name value          change a parameter (saved to EEPROM, apart from nose)
+ *   cal                     show the calibration
+ *   cal acc | cal mag       run the accelerometer (cube level, Z up) or magnetometer calibration
+ *   cal leds                show each colour on every face, for setting the scales
+ *   cal vcc mV              calibrate the battery monitor with the supply voltage read from a meter
+ *   scale [led r g b]       show or set the white balance of the LEDs (LED_SCALE_ONE is unscaled)
+ *   log | log clear         dump (for tools/decode_eventlog.py) or clear the event log
+ *   telemetry on | off      stream telemetry and log messages (see telemetry.h)
+ *   defaults                restore the default configuration
+ *
+ * Parameters are nose (0-5), bearing (0-359 degrees) and the behaviour timings of the
+ * configuration record. Values are whole numbers, digits only.
+ */
+
+typedef struct {
+	char name[19];
+	unsigned char offset; //Of the field in ConfigRecord
+	uint16_t max;
+} ShellParam;
+
+static const ShellParam params[] PROGMEM = {
+	{"bearing", offsetof(ConfigRecord, bearing), 359},
+	{"nose_anims_min", offsetof(ConfigRecord, nose_anims_min), 65535U},
+	{"nose_anims_max", offsetof(ConfigRecord, nose_anims_max), 65535U},
+	{"anim_gap_min", offsetof(ConfigRecord, anim_gap_min), 65535U},
+	{"anim_gap_max", offsetof(ConfigRecord, anim_gap_max), 65535U},
+	{"apoplexy_threshold", offsetof(ConfigRecord, apoplexy_threshold), 65535U},
+	{"apoplexy_sleep", offsetof(ConfigRecord, apoplexy_sleep), 65535U},
+	{"vibrate_threshold", offsetof(ConfigRecord, vibrate_threshold), 65535U},
+};
+#define NUM_PARAMS (sizeof(params) / sizeof(params[0]))
+
+static char line[SHELL_LINE_MAX + 1];
+static unsigned char linelen = 0;
+static boolean overflow = false;
+
+/*
+ * Is something driving the RX line? The USB serial chip holds it high while it is powered.
+ *
+ * With nothing attached the pin floats, keeping whatever level it was last at, so on its own
+ * a read proves nothing. Each sample first drives the pin low and lets it go: a host pulls it
+ * straight back up (through the board's series resistor, so driving against it briefly is
+ * harmless) while a floating pin stays low. Every sample must read high.
+ *
+ * A byte waiting counts as a host. Otherwise an open port is closed for the test, as the
+ * receiver has the pin and does not pull it either way, so a host unplugged while it was open
+ * would leave the pin high and keep the cube awake for good. The port is opened again if the
+ * host is still there, and left closed if not.
+ */
+boolean shell_host_attached() {
+	boolean was_on = serial_is_on();
+
+	if(was_on && Serial.available() > 0) return true;
+	serial_off();
+
+	for(unsigned char i = 0; i < SHELL_ATTACH_SAMPLES; i++) {
+		if(i > 0) delayMicroseconds(SHELL_ATTACH_INTERVAL_US);
+		digitalWrite(SHELL_RX_PIN, LOW);
+		pinMode(SHELL_RX_PIN, OUTPUT);
+		pinMode(SHELL_RX_PIN, INPUT);
+		delayMicroseconds(SHELL_ATTACH_SETTLE_US);
+		if(digitalRead(SHELL_RX_PIN) != HIGH) return false;
+	}
+	if(was_on) serial_on();
+	return true;
+}
+
+static uint16_t *param_field(unsigned char i) {
+	return (uint16_t *) ((unsigned char *) &config + pgm_read_byte(&params[i].offset));
+}
+
+static void print_param(unsigned char i) {
+	char name[sizeof(params[0].name)];
+	strcpy_P(name, params[i].name);
+	Serial.print(name);
+	Serial.print(' ');
+	Serial.println(*param_field(i));
+}
+
+static void get(const char *name) {
+	if(name == NULL || strcmp_P(name, PSTR("nose")) == 0) {
+		Serial.print(F("nose "));
+		Serial.println(getNose());
+	}
+	for(unsigned char i = 0; i < NUM_PARAMS; i++) {
+		if(name == NULL || strcmp_P(name, params[i].name) == 0) print_param(i);
+	}
+}
+
+//A whole number from 0 to max, digits only: atol() would take "x" as 0
+static boolean parse(const char *value, uint16_t max, uint16_t *v) {
+	long n = 0;
+
+	if(*value == '\0') return false;
+	for(; *value != '\0'; value++) {
+		if(*value < '0' || *value > '9') return false;
+		n = n * 10 + (*value - '0');
+		if(n > max) return false;
+	}
+	*v = n;
+	return true;
+}
+
+static boolean set(const char *name, const char *value) {
+	uint16_t v;
+
+	if(name == NULL || value == NULL) return false;
+
+	if(strcmp_P(name, PSTR("nose")) == 0) {
+		if(!parse(value, 5, &v)) return false;
+		setNose(v);
+		return true;
+	}
+	for(unsigned char i = 0; i < NUM_PARAMS; i++) {
+		if(strcmp_P(name, params[i].name) == 0) {
+			if(!parse(value, pgm_read_word(&params[i].max), &v)) return false;
+			*param_field(i) = v;
+			save_config();
+			print_param(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void print_calibration() {
+	Serial.print(F("acc"));
+	for(unsigned char i = 0; i < 3; i++) {
+		Serial.print(' ');
+		Serial.print(config.acc_calibration[i]);
+	}
+	Serial.print(F("\r\nmag"));
+	for(unsigned char i = 0; i < 6; i++) {
+		Serial.print(' ');
+		Serial.print(config.mag_calibration[i]);
+	}
+	Serial.print(F("\r\nbandgap "));
+	Serial.print(config.bandgap_mv);
+	Serial.print(F(" vcc "));
+	Serial.println(battery_measure_mv());
+}
+
+//cal vcc mV
+static boolean calibrate_vcc(const char *mv) {
+	long v;
+
+	if(mv == NULL) return false;
+	v = atol(mv);
+	if(v <= 0 || v > 6000) return false;
+	return battery_calibrate(v);
+}
+
+static void print_scales() {
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		Serial.print(F("scale "));
+		Serial.print(i);
+		for(unsigned char ch = 0; ch < 3; ch++) {
+			Serial.print(' ');
+			Serial.print(config.led_scale[i][ch]);
+		}
+		Serial.println();
+	}
+}
+
+//scale led r g b
+static boolean set_scale(char *led) {
+	long v[3];
+	long i;
+
+	if(led == NULL) return false;
+	i = atol(led);
+	if(i < 0 || i >= NUMLEDS) return false;
+	for(unsigned char ch = 0; ch < 3; ch++) {
+		char *arg = strtok(NULL, " ");
+		if(arg == NULL) return false;
+		v[ch] = atol(arg);
+		if(v[ch] < 0 || v[ch] > LED_SCALE_ONE) return false;
+	}
+	for(unsigned char ch = 0; ch < 3; ch++) config.led_scale[i][ch] = v[ch];
+	save_config();
+	return true;
+}
+
+static boolean is(const char *word, PGM_P command) {
+	return word != NULL && strcmp_P(word, command) == 0;
+}
+
+static void execute() {
+	char *cmd = strtok(line, " ");
+	char *arg1 = strtok(NULL, " ");
+	boolean ok = true;
+
+	if(cmd == NULL) return;
+
+	if(is(cmd, PSTR("help"))) {
+		Serial.println(F("get [name], set name value, cal [acc|mag|leds|vcc mV], scale [led r g b], log [clear], telemetry on|off, defaults"));
+	} else if(is(cmd, PSTR("get"))) {
+		get(arg1);
+	} else if(is(cmd, PSTR("set"))) {
+		ok = set(arg1, strtok(NULL, " "));
+	} else if(is(cmd, PSTR("cal"))) {
+		if(is(arg1, PSTR("leds"))) {
+			calibrate_leds();
+		} else {
+			if(is(arg1, PSTR("acc"))) calibration();
+			else if(is(arg1, PSTR("mag"))) calibrate_magnetometer();
+			else if(is(arg1, PSTR("vcc"))) ok = calibrate_vcc(strtok(NULL, " "));
+			else ok = (arg1 == NULL);
+			if(ok) print_calibration();
+		}
+	} else if(is(cmd, PSTR("scale"))) {
+		if(arg1 == NULL) print_scales();
+		else ok = set_scale(arg1);
+	} else if(is(cmd, PSTR("log"))) {
+		if(is(arg1, PSTR("clear"))) clear_event_log();
+		else dump_event_log();
+	} else if(is(cmd, PSTR("telemetry"))) {
+		if(is(arg1, PSTR("on"))) telemetry_on = true;
+		else if(is(arg1, PSTR("off"))) telemetry_on = false;
+		else ok = false;
+	} else if(is(cmd, PSTR("defaults"))) {
+		//Keep the sequence running, or an older record would look newer at the next boot
+		unsigned char sequence = config.sequence;
+		default_config(&config);
+		config.sequence = sequence;
+		save_config();
+	} else {
+		ok = false;
+	}
+
+	Serial.println(ok ? F("ok") : F("error"));
+}
+
+void shell_poll() {
+	while(Serial.available() > 0) {
+		char c = Serial.read();
+
+		if(c == '\r' || c == '\n') {
+			if(overflow) {
+				Serial.println(F("error"));
+			} else if(linelen > 0) {
+				line[linelen] = 0;
+				execute();
+			}
+			linelen = 0;
+			overflow = false;
+		} else if(c == 8 || c == 127) {
+			if(linelen > 0) linelen--;
+		} else if(linelen < SHELL_LINE_MAX) {
+			line[linelen++] = c;
+		} else {
+			overflow = true;
+		}
+	}
+}
@@ -0,0 +1,10 @@
+#ifndef __SHELL_H_
+#define __SHELL_H_
+
+//Longest command line accepted
+#define SHELL_LINE_MAX 32
+
+boolean shell_host_attached();
+void shell_poll();
+
+#endif
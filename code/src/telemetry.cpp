@@ -0,0 +1,132 @@
+#include "Arduino.h"
+#include "options.h"
+#include "telemetry.h"
+#include "compass.h"
+#include "behaviour.h"
+#include "utils.h"
+#include "peripherals.h"
+#include <util/crc16.h>
+
+/*
+ * Binary telemetry.
+ *
+ * Each frame is type, sequence number, payload and a CRC8 of all three, COBS encoded so that
+ * the only zero byte on the line is the delimiter which ends each frame. The host can join the
+ * stream at any point, and anything else written to the serial line is discarded as a bad frame.
+ * tools/decode_telemetry.py turns the stream into CSV.
+ *
+ * The serial transmit buffer is already drained by the USART interrupt. How full it is is
+ * worked out from the time each frame will take to go, and a frame is only handed over if it
+ * fits, so that sending never blocks. Frames that do not fit are dropped and counted, unless
+ * the caller asks to wait.
+ */
+
+//Time on the line of one byte (start, 8 data and stop bits), rounded up
+#define BYTE_US ((10000000UL + BAUD_RATE - 1) / BAUD_RATE)
+
+//Payload of a TELEMETRY_SENSORS frame. Multi-byte fields are little endian, as on the AVR.
+typedef struct {
+	unsigned long millis;
+	int acc[3]; //1/1024 G
+	int mag[3]; //Scaled magnetometer units
+	int heading; //Degrees
+	unsigned char confidence;
+	unsigned char top;
+	unsigned char nose;
+	unsigned char state; //BEHAVIOUR_*
+	unsigned int loop_us; //Time taken to read the sensors and update the orientation
+	unsigned int bringup_us; //Of the last cold sensor bring-up, saturating
+	unsigned char dropped; //Frames dropped since the last one sent, saturating
+} __attribute__((packed)) SensorFrame;
+
+boolean telemetry_on = false;
+
+static unsigned char sequence = 0;
+static unsigned char dropped = 0;
+static unsigned long tx_free_at = 0;
+static boolean synced = false;
+
+//Bytes still waiting in the serial transmit buffer
+static unsigned int tx_queued() {
+	long remaining = tx_free_at - micros();
+	return remaining > 0 ? remaining / BYTE_US + 1 : 0;
+}
+
+boolean telemetry_send(unsigned char type, const void *payload, unsigned char len, boolean wait) {
+	unsigned char raw[TELEMETRY_MAX_PAYLOAD + 3];
+	unsigned char out[TELEMETRY_MAX_PAYLOAD + 5];
+	unsigned char n = 0, code = 1, codepos = 0, o = 1;
+	unsigned char crc = 0;
+
+	//With the USART off nothing would drain the queue, and a waiting caller would wait forever
+	if(len > TELEMETRY_MAX_PAYLOAD || !serial_is_on()) return false;
+
+	raw[n++] = type;
+	raw[n++] = sequence++;
+	memcpy(raw + n, payload, len);
+	n += len;
+	for(unsigned char i = 0; i < n; i++) crc = _crc8_ccitt_update(crc, raw[i]);
+	raw[n++] = crc;
+
+	//COBS: each zero is replaced by the distance to the next zero, and a final zero ends the frame
+	for(unsigned char i = 0; i < n; i++) {
+		if(raw[i] == 0) {
+			out[codepos] = code;
+			codepos = o++;
+			code = 1;
+		} else {
+			out[o++] = raw[i];
+			code++;
+		}
+	}
+	out[codepos] = code;
+	out[o++] = 0;
+
+	if(tx_queued() + o + 1 > TELEMETRY_TX_BUFFER) {
+		if(!wait) {
+			if(dropped < 255) dropped++;
+			sequence--;
+			return false;
+		}
+		while(tx_queued() + o + 1 > TELEMETRY_TX_BUFFER);
+	}
+
+	//Delimit the first frame from any text that went before it
+	if(!synced) {
+		Serial.write((unsigned char) 0);
+		synced = true;
+	}
+	Serial.write(out, o);
+	if((long) (tx_free_at - micros()) < 0) tx_free_at = micros();
+	tx_free_at += o * BYTE_US;
+	return true;
+}
+
+//Send a sensor snapshot, if the line is free
+void telemetry_sensors(AccelerometerScaled acc, MagnetometerScaled mag, int heading, unsigned int loop_us) {
+	SensorFrame f;
+
+	f.millis = millis();
+	f.acc[0] = acc.XAxis * 1024;
+	f.acc[1] = acc.YAxis * 1024;
+	f.acc[2] = acc.ZAxis * 1024;
+	f.mag[0] = mag.XAxis;
+	f.mag[1] = mag.YAxis;
+	f.mag[2] = mag.ZAxis;
+	f.heading = heading;
+	f.confidence = getHeadingConfidence();
+	f.top = getTop();
+	f.nose = getNose();
+	f.state = behaviour_state();
+	f.loop_us = loop_us;
+	f.bringup_us = min(sensor_bringup_us, 65535UL);
+	f.dropped = dropped;
+
+	if(telemetry_send(TELEMETRY_SENSORS, &f, sizeof(f), false)) dropped = 0;
+}
+
+//Mirror an event log entry (see eventlog.h). Events are rare, so these wait for the line.
+void telemetry_event(unsigned char type, unsigned char arg) {
+	unsigned char e[2] = {type, arg};
+	telemetry_send(TELEMETRY_EVENT, e, sizeof(e), true);
+}
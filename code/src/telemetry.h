@@ -0,0 +1,24 @@
+#ifndef __TELEMETRY_H_
+#define __TELEMETRY_H_
+
+#include "ADXL345.h"
+#include "HMC5883L.h"
+
+//Telemetry is streamed in debug builds (see DEBUG in options.h), or when turned on from the shell
+extern boolean telemetry_on;
+#define TELEMETRY_ENABLED ((DEBUG) >= 1 || telemetry_on)
+
+//Frame types. Values must not be reused, as the host decoder relies on them.
+#define TELEMETRY_SENSORS 1
+#define TELEMETRY_EVENT 2
+#define TELEMETRY_LOG 3 //See tokenlog.h
+
+//Size of the HardwareSerial transmit ring. An encoded frame (payload plus 5 bytes) must fit within it.
+#define TELEMETRY_TX_BUFFER 64
+#define TELEMETRY_MAX_PAYLOAD 48
+
+boolean telemetry_send(unsigned char type, const void *payload, unsigned char len, boolean wait);
+void telemetry_sensors(AccelerometerScaled acc, MagnetometerScaled mag, int heading, unsigned int loop_us);
+void telemetry_event(unsigned char type, unsigned char arg);
+
+#endif
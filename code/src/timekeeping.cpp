@@ -0,0 +1,56 @@
+#include "Arduino.h"
+#include "options.h"
+#include "timekeeping.h"
+#include "Narcoleptic.h"
+#include <avr/wdt.h>
+
+/*
+ * Virtual wall clock.
+ *
+ * millis() stops while Narcoleptic has the processor powered down, so on its own it only
+ * counts the time spent awake. The clock adds the time spent asleep, counted in watchdog
+ * periods. The watchdog oscillator is only accurate to around 10% and drifts with temperature,
+ * so its period is measured against the crystal from time to time (see clock_calibrate()).
+ *
+ * uptime_seconds() is monotonic from boot and should be used in place of counting sleeps.
+ */
+
+static unsigned long uptime_s = 0;
+static unsigned int uptime_ms = 0;
+static unsigned long last_millis = 0;
+
+//Length of an 8 second watchdog period as measured, in milliseconds
+static unsigned long wdt8_ms = 8000;
+
+static void clock_add_ms(unsigned long ms) {
+	ms += uptime_ms;
+	uptime_s += ms / 1000;
+	uptime_ms = ms % 1000;
+}
+
+//Seconds since boot, including time asleep
+unsigned long uptime_seconds() {
+	unsigned long now = millis();
+	clock_add_ms(now - last_millis);
+	last_millis = now;
+	return uptime_s;
+}
+
+//Account for a power-down sleep of the given number of 8 second watchdog periods
+void clock_slept(unsigned int eightsecs) {
+	clock_add_ms((unsigned long) eightsecs * wdt8_ms);
+}
+
+/*
+ * Measure the watchdog period against the crystal. A 500ms period is timed (the 8 second
+ * period is a fixed multiple of it, as all periods divide the same 128kHz oscillator),
+ * which keeps the processor awake for about half a second.
+ */
+void clock_calibrate() {
+	unsigned long us = Narcoleptic.measureWatchdog(WDTO_500MS);
+	wdt8_ms = (us * 16 + 500) / 1000;
+}
+
+unsigned long wdt_period_ms() {
+	return wdt8_ms;
+}
@@ -0,0 +1,9 @@
+#ifndef __TIMEKEEPING_H_
+#define __TIMEKEEPING_H_
+
+unsigned long uptime_seconds();
+void clock_slept(unsigned int eightsecs);
+void clock_calibrate();
+unsigned long wdt_period_ms();
+
+#endif
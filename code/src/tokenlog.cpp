@@ -0,0 +1,18 @@
+#include "Arduino.h"
+#include "options.h"
+#include "tokenlog.h"
+#include "telemetry.h"
+#include "peripherals.h"
+
+//Send a tokenised message (see tokenlog.h). The payload is the ID, then each argument, all little endian.
+void log_token(unsigned int id, unsigned char nargs, long a, long b, long c) {
+	long args[3] = {a, b, c};
+	unsigned char payload[2 + sizeof(args)];
+
+	if(!TELEMETRY_ENABLED || !serial_is_on()) return;
+
+	payload[0] = id;
+	payload[1] = id >> 8;
+	memcpy(payload + 2, args, nargs * sizeof(long));
+	telemetry_send(TELEMETRY_LOG, payload, 2 + nargs * sizeof(long), false);
+}
@@ -0,0 +1,36 @@
+#ifndef __TOKENLOG_H_
+#define __TOKENLOG_H_
+
+/*
+ * Tokenised logging.
+ *
+ * LOG0() to LOG3() take a printf style format and up to three integer arguments. The format
+ * never reaches the device: the preprocessor drops it, and only a message ID made from the
+ * file's LOG_FILE number and the line number is sent, with each argument as 4 raw bytes, in a
+ * telemetry frame. tools/extract_log_strings.py builds the dictionary of formats from the
+ * sources, which tools/decode_telemetry.py uses to print the messages.
+ *
+ * Each file that logs defines its own LOG_FILE (1 to 31) before including this header, and
+ * each LOGn() call must be on a single line of its own, within the first 2047 lines.
+ *   1 animations.cpp  2 behaviour.cpp  3 compass.cpp  4 jacube.cpp
+ *
+ * Messages are only sent while telemetry is enabled and the serial line is open, so logging
+ * costs a couple of flag tests otherwise.
+ */
+
+#ifdef ENABLE_LOGGING
+#define LOG_ID (((unsigned int) (LOG_FILE) << 11) | __LINE__)
+#define LOG0(fmt) log_token(LOG_ID, 0, 0, 0, 0)
+#define LOG1(fmt, a) log_token(LOG_ID, 1, (long) (a), 0, 0)
+#define LOG2(fmt, a, b) log_token(LOG_ID, 2, (long) (a), (long) (b), 0)
+#define LOG3(fmt, a, b, c) log_token(LOG_ID, 3, (long) (a), (long) (b), (long) (c))
+#else
+#define LOG0(fmt)
+#define LOG1(fmt, a)
+#define LOG2(fmt, a, b)
+#define LOG3(fmt, a, b, c)
+#endif
+
+void log_token(unsigned int id, unsigned char nargs, long a, long b, long c);
+
+#endif
@@ -4,60 +4,56 @@
 #include "ADXL345.h"
 #include "HMC5883L.h"
 #include "compass.h"
-#include <EEPROM.h>
 #include "leds.h"
 #include "Narcoleptic.h"
+#include "entropy.h"
+#include "config.h"
+#include "eventlog.h"
+#include "timekeeping.h"
+#include "peripherals.h"
+#include "telemetry.h"
+#include "shell.h"
 #include <avr/power.h>
 
 #ifndef cbi
 #define cbi(sfr, bit) (_SFR_BYTE(sfr) &= ~_BV(bit))
 #endif
 
-extern int target_bearing;
 extern ADXL345 accel;
-extern int calibration_data[3];
 extern HMC5883L compass;
 
 //------------------------------------------------------------------------------------------------------
-// Serial and UI functions
-
-/*
- * Read a new bearing from the serial line. Entered in integer degrees as 3 ASCII digits.
- */
-void read_new_bearing() {
-	char buf[3];
-	Serial.print("Enter new bearing: ");
-
-	for(int i = 0; i < 3; i++) {
-		while(Serial.available() == 0);
-		buf[i] = Serial.read();
+// Sensor functions
 
-		if(!(buf[i] >= '0' && buf[i] <= '9')) {
-			Serial.println("Error. Enter as 3 ASCII digits.");
-			return;
-		}
-	}
+//Bring-up states of the sensor board
+#define SENSORS_OFF 0
+#define SENSORS_POWERED 1
+#define SENSORS_CONFIGURED 2
+#define SENSORS_READY 3
 
-	int bearing = (buf[0] - '0') * 100 + (buf[1] - '0') * 10 + (buf[2] - '0');
-	write_bearing(bearing);
-	target_bearing = bearing;
-}
+unsigned char sensor_state = SENSORS_OFF;
 
-//Set a new nose value by reading from the serial line
-void setNoseFromSerial() {
-	char c = Serial.read();
-	c = c - '0';
-	if(c >= 0 && c <= 5) {
-		setNose(c);
-		Serial.print("Nose set to: ");
-		Serial.println(getNose());
-	}
-}
+//Benchmarks of the last cold bring-up. Both are in microseconds from the sensor power being applied.
+unsigned long sensor_bringup_us = 0; //Until the accelerometer produced a valid ~1G sample
+unsigned long first_heading_us = 0; //Until refresh_sensors() produced the first heading
+static unsigned long bringup_start_us;
+static boolean heading_pending = false;
 
-//------------------------------------------------------------------------------------------------------
-// Sensor functions
+//Benchmarks of the last long sleep (see power_sleep_long()), in microseconds
+unsigned long sleep_entry_us = 0; //Shutting everything down before it
+unsigned long sleep_awake_us = 0; //Awake during the sleep itself, over sleep_slices watchdog wakes
+unsigned int sleep_slices = 0;
 
-//Power up the sensor board, activate the sensors we need, initialise them, calibrate the accelerometer.
+/*
+ * Power up the sensor board, activate the sensors we need, initialise them, calibrate the accelerometer.
+ *
+ * This is a small state machine (off -> powered -> configured -> ready). If the sensors are still
+ * powered and configured from an earlier call, a single register read confirms this and reconfiguration
+ * is skipped. From cold, waits are taken from the datasheet power-up times rather than a fixed delay.
+ * Failed attempts back off and fall back to reconfiguring.
+ *
+ * Returns the number of configuration attempts made (0 for a warm start).
+ */
 int enable_sensors() {
 #ifndef ENABLE_SENSORS
 	return 0;
@@ -65,34 +61,72 @@ int enable_sensors() {
 	AccelerometerScaled acc;
 	int cyclecount = 0;
 
-	pinMode(PIN_SENSOR_POWER, OUTPUT);
-	digitalWrite(PIN_SENSOR_POWER, HIGH);
-
-	while(1) {
-		delay(100);
-		cyclecount++;
-		TWCR = 0;
-		TWCR = TWEN;
-		Wire.begin();
-
-		if(!accel.EnsureConnected()) continue;
-
-		if(accel.SetRange(2, true) != 0) { //Accelerometer range, 2Gs
-			continue; //Try again
+	//Warm start. If measurement is still enabled then the part has not lost power so all registers are valid.
+	if(sensor_state == SENSORS_READY) {
+		if(accel.MeasurementsEnabled()) {
+			compass.SetMeasurementMode(COMPASS_MEASURE_IDLE);
+			return 0;
 		}
+		sensor_state = SENSORS_POWERED;
+	}
+
+	while(sensor_state != SENSORS_READY) {
+		switch(sensor_state) {
+		case SENSORS_OFF:
+			peripheral_acquire(PERIPH_TWI);
+			pinMode(PIN_SENSOR_POWER, OUTPUT);
+			digitalWrite(PIN_SENSOR_POWER, HIGH);
+			bringup_start_us = micros();
+			delay(SENSOR_POWERUP_MS);
+			sensor_state = SENSORS_POWERED;
+			break;
+
+		case SENSORS_POWERED:
+			cyclecount++;
+			if(cyclecount > 1) delay(SENSOR_RETRY_MS);
+			TWCR = 0;
+			TWCR = TWEN;
+			Wire.begin();
+
+			if(!accel.EnsureConnected()) break;
+
+			if(accel.SetRange(2, true) != 0) { //Accelerometer range, 2Gs
+				break; //Try again
+			}
 
-		accel.SetOffset(calibration_data[0], calibration_data[1], calibration_data[2]);
-		accel.EnableMeasurements();
+			accel.SetOffset(config.acc_calibration[0], config.acc_calibration[1], config.acc_calibration[2]);
+			accel.SetDataRate(ACCEL_DATA_RATE);
+			accel.EnableMeasurements();
 
-		if(accel.ReadScaledAxis(&acc)) {
-			float mag = sqrt(acc.XAxis*acc.XAxis + acc.YAxis*acc.YAxis + acc.ZAxis*acc.ZAxis);
-			if(mag > 0.5 && mag < 1.5) {
-				break;
+			compass.SetScale(1.3); //Compass scale +/- 1.3 Ga
+			compass.SetAveraging(COMPASS_AVERAGING);
+#ifdef PIN_COMPASS_DRDY
+			compass.SetDataReadyPin(PIN_COMPASS_DRDY);
+#endif
+			//First accelerometer sample is ready 1.1ms + 1/ODR after measurement is enabled
+			delay(ACCEL_SAMPLE_MS + 2);
+			sensor_state = SENSORS_CONFIGURED;
+			break;
+
+		case SENSORS_CONFIGURED:
+			sensor_state = SENSORS_POWERED;
+			if(accel.ReadScaledAxis(&acc)) {
+				float mag = sqrt(acc.XAxis*acc.XAxis + acc.YAxis*acc.YAxis + acc.ZAxis*acc.ZAxis);
+				if(mag > 0.5 && mag < 1.5) {
+					sensor_state = SENSORS_READY;
+				}
 			}
+			break;
 		}
 	}
-	compass.SetScale(1.3); //Compass scale +/- 1.3 Ga
-	compass.SetMeasurementMode(COMPASS_MEASURE_CONTINUOUS);
+
+	//Leave the magnetometer idle. Headings are taken on demand with single-shot reads
+	//unless something (e.g. play_animation()) switches it to continuous mode.
+	compass.SetMeasurementMode(COMPASS_MEASURE_IDLE);
+
+	sensor_bringup_us = micros() - bringup_start_us;
+	heading_pending = true;
+	if(cyclecount > 1) log_event(EVENT_SENSOR_RETRIES, min(cyclecount, 255));
 	return cyclecount;
 }
 
@@ -111,88 +145,124 @@ void disable_sensors() {
 #endif
 	digitalWrite(PIN_SENSOR_POWER, LOW);
 	pinMode(PIN_SENSOR_POWER, INPUT);
+	if(sensor_state != SENSORS_OFF) {
+		TWCR = 0; //Release the TWI pins before gating its clock
+		peripheral_release(PERIPH_TWI);
+	}
+	sensor_state = SENSORS_OFF;
+	resetOrientation();
 }
 
 //Gather entropy for PRNG from the lower bits of the accelerometer
-//Activates sensors, checks for their presence.
-//Returns false if sensors were not found, true if all OK
+//Sensors must already be enabled, and are left enabled.
+//Returns false if no samples were read, true if all OK
 boolean gather_entropy() {
-	enable_sensors();
+	AccelerometerRaw window[ADXL345_FIFO_SIZE];
+	unsigned char samples;
 
-	//TODO: Add von Neumann de-bias filter as 0 dominates
-	int seed = 0;
-	for(int i = 0; i < 32; i++) {
-		AccelerometerRaw raw;
-		if(accel.ReadRawAxis(&raw) == true) {
-			if(raw.XAxis & 1) {
-				seed = seed | 1;
-			}
-			seed = seed << 1;
-		} else {
-			//Not a big deal in the entropy generator
-		}
+	//Take the samples from the FIFO so that each one is a fresh conversion, rather than
+	//reading the same output registers several times between updates.
+	samples = sample_accel_window(window, ADXL345_FIFO_SIZE);
+
+	//The pool debiases the LSBs and reseeds the PRNG as it fills
+	for(unsigned char i = 0; i < samples; i++) {
+		entropy_add_sample(window[i].XAxis, window[i].YAxis, window[i].ZAxis);
 	}
-	randomSeed(seed);
-	disable_sensors();
-	return true;
+	entropy_flush();
+	return samples > 0;
+}
+
+
+/*
+ * Collect a window of count accelerometer samples (at most ADXL345_FIFO_SIZE) using the
+ * accelerometer's FIFO. The processor sleeps while the FIFO fills, then the whole window
+ * is drained in one burst. Sensors must already be enabled.
+ * Returns the number of samples placed into buf.
+ */
+unsigned char sample_accel_window(AccelerometerRaw *buf, unsigned char count) {
+	if(count > ADXL345_FIFO_SIZE) count = ADXL345_FIFO_SIZE;
+
+	//Bypass mode empties the FIFO, then FIFO mode collects samples until it is full
+	accel.SetFifoMode(ADXL345_FIFO_BYPASS, 0);
+	accel.SetFifoMode(ADXL345_FIFO_FIFO, 0);
+
+	//Power-down sleep stops the USART so let any pending output go first
+	Serial.flush();
+	Narcoleptic.delay(count * ACCEL_SAMPLE_MS);
+
+	//Narcoleptic rounds down to whole watchdog periods, so top up if the window is short
+	for(unsigned char i = 0; i < 8 && accel.FifoEntries() < count; i++) {
+		delay(ACCEL_SAMPLE_MS);
+	}
+
+	count = accel.ReadRawFifo(buf, count);
+	accel.SetFifoMode(ADXL345_FIFO_BYPASS, 0);
+	return count;
 }
 
 
+//Take a fresh single-shot heading and update the cached bearing and up face
 void refresh_sensors() {
 	AccelerometerScaled acc;
 	MagnetometerScaled mag;
-
-	if(accel.ReadScaledAxis(&acc) && compass.ReadScaledAxis(&mag)) {
-		getHeading(mag, acc);
+	unsigned long start = micros();
+
+	if(accel.ReadScaledAxis(&acc) && compass.ReadScaledSingleShot(&mag)) {
+		int heading = updateOrientation(mag, acc);
+		if(TELEMETRY_ENABLED) telemetry_sensors(acc, mag, heading, micros() - start);
+		//Keep topping up the entropy pool from the magnetometer noise
+		entropy_add_sample(mag.XAxis, mag.YAxis, mag.ZAxis);
+		if(heading_pending) {
+			first_heading_us = micros() - bringup_start_us;
+			heading_pending = false;
+		}
 	}
 }
 
 
 /**
  * Perform calibration of the accelerometer. This assumes that the device is level and with Z upwards.
- * Takes 100 samples, averages them, and writes the appropriate offsets into the offset registers
- * of the accelerometer.
+ * Takes 96 samples (three full FIFO windows), averages them, and writes the appropriate offsets into
+ * the offset registers of the accelerometer.
  * This function also saves the determined calibration values into the EEPROM
  */
 void calibration() {
-	float xa, ya, za;
+	AccelerometerRaw window[ADXL345_FIFO_SIZE];
+	long xa = 0, ya = 0, za = 0;
+	int count = 0;
+
 	enable_sensors();
 
 	//Zero the offset registers first
 	accel.SetOffset(0, 0, 0);
 
-	//Take 100 samples
-	AccelerometerScaled scaled;
-	while(accel.ReadScaledAxis(&scaled) == false); //Loop until a valid sample is read.
-
-	xa = scaled.XAxis;
-	ya = scaled.YAxis;
-	za = scaled.ZAxis;
-	for(int i = 0; i < 100; i++) {
-		if(accel.ReadScaledAxis(&scaled)) {
-			xa = (xa + scaled.XAxis) / 2.0;
-			ya = (ya + scaled.YAxis) / 2.0;
-			za = (za + scaled.ZAxis) / 2.0;
-		} else {
-			//Ignored for this loop
+	for(unsigned char w = 0; w < 3; w++) {
+		unsigned char samples = sample_accel_window(window, ADXL345_FIFO_SIZE);
+		for(unsigned char i = 0; i < samples; i++) {
+			xa += window[i].XAxis;
+			ya += window[i].YAxis;
+			za += window[i].ZAxis;
 		}
+		count += samples;
+	}
+
+	if(count == 0) {
+		//No samples could be read, so leave the existing calibration alone
+		disable_sensors();
+		return;
 	}
-	//Account for expected 1G in the z-axis
-	za = za - 1.0;
 
-	//Prepare accelerometer offset values. Values are converted to 1 == 15.6mG
-	float xoff, yoff, zoff;
-	xoff = xa / 15.6 * 1000;
-	yoff = ya / 15.6 * 1000;
-	zoff = za / 15.6 * 1000;
+	//Account for expected 1G in the z-axis (full resolution is 3.9mG per LSB, so 1G == 256)
+	za = za - 256L * count;
 
-	int offset_vals[3];
-	offset_vals[0] = -round(xoff);
-	offset_vals[1] = -round(yoff);
-	offset_vals[2] = -round(zoff);
+	//Prepare accelerometer offset values. Offsets are 15.6mG per LSB, i.e. four sample LSBs.
+	int16_t *offset_vals = config.acc_calibration;
+	offset_vals[0] = -round((float)xa / count / 4);
+	offset_vals[1] = -round((float)ya / count / 4);
+	offset_vals[2] = -round((float)za / count / 4);
 
 	//Save calibration data into the EEPROM
-	write_calibration(offset_vals);
+	save_config();
 
 	//Write the resulting offsets into the chip
 	accel.SetOffset(offset_vals[0], offset_vals[1], offset_vals[2]);
@@ -200,41 +270,69 @@ void calibration() {
 	disable_sensors();
 }
 
-//-----------------------------------------------------------------------------------
-// Configuration
+/**
+ * Calibrate the magnetometer against the hard and soft iron distortion of the motor, battery
+ * and speaker. The user should turn the cube through every orientation while the faces light
+ * up one by one, which takes MAG_CALIBRATION_MS. The extremes seen on each axis are fitted
+ * with fit_mag_calibration(), saved into the EEPROM and used by getHeading() from then on.
+ */
+void calibrate_magnetometer() {
+	int mins[3] = {32767, 32767, 32767};
+	int maxs[3] = {-32767, -32767, -32767};
+	unsigned long start;
 
-#define EEPROMBYTESUSED 4
-#define BEARING_ADDR 0
-#define ACC_CALIBRATION_ADDR 1
+	enable_sensors();
+	compass.SetMeasurementMode(COMPASS_MEASURE_CONTINUOUS);
+	start_led_scanner();
+
+	start = millis();
+	while(millis() - start < MAG_CALIBRATION_MS) {
+		MagnetometerScaled mag;
+		if(compass.ReadScaledAxis(&mag)) {
+			int vals[3] = {(int) mag.XAxis, (int) mag.YAxis, (int) mag.ZAxis};
+			for(unsigned char i = 0; i < 3; i++) {
+				//Ignore anything as strong as a pacification magnet
+				if(abs(vals[i]) > PACIFICATION_THRESHOLD) continue;
+				if(vals[i] < mins[i]) mins[i] = vals[i];
+				if(vals[i] > maxs[i]) maxs[i] = vals[i];
+			}
+		}
 
-void clear_eeprom() {
-	for(int i = 0; i < EEPROMBYTESUSED; i++) {
-		EEPROM.write(i, 0);
+		//Show progress
+		setLED((millis() - start) * NUMLEDS / MAG_CALIBRATION_MS, 0, LED_SCANMAX - 1, 0);
+		delay(SENSE_MS / 2);
 	}
-}
-
-void write_bearing(int bearing) {
-	EEPROM.write(BEARING_ADDR, bearing);
-}
 
-int read_bearing() {
-	return EEPROM.read(BEARING_ADDR);
-}
+	fit_mag_calibration(mins, maxs, config.mag_calibration);
+	save_config();
 
-void write_calibration(int *buf) {
-	for(int i = 0; i < 3; i++) {
-		EEPROM.write(ACC_CALIBRATION_ADDR + i, buf[i]);
-	}
+	clearLEDs();
+	stop_led_scanner();
+	disable_sensors();
 }
 
-void read_calibration(int *buf) {
-	for(int i = 0; i < 3; i++) {
-		buf[i] = EEPROM.read(ACC_CALIBRATION_ADDR + i);
+/**
+ * Drive the LEDs for white balance calibration. Every face shows red, then green, then blue, then
+ * white, each for LED_CALIBRATION_MS, with the current scale factors applied. Channels which look
+ * brighter than on the other faces, and tinted whites, are corrected with the shell's scale
+ * command (see shell.cpp) and checked by running this again.
+ */
+void calibrate_leds() {
+	start_led_scanner();
+	for(unsigned char step = 0; step < 4; step++) {
+		unsigned char r = (step == 0 || step == 3) ? LED_SCANMAX : 0;
+		unsigned char g = (step == 1 || step == 3) ? LED_SCANMAX : 0;
+		unsigned char b = (step == 2 || step == 3) ? LED_SCANMAX : 0;
+		for(unsigned char i = 0; i < NUMLEDS; i++) setLED(i, r, g, b);
+		delay(LED_CALIBRATION_MS);
 	}
+	clearLEDs();
+	stop_led_scanner();
 }
 
+//-----------------------------------------------------------------------------------
 
-
+//Convert to 8 bit channels for setLED8(). h is 0 to 360, s and v 0 to 100.
 void HSV_to_RGB(float h, float s, float v, byte &r, byte &g, byte &b) {
 	int i;
 	float f,p,q,t;
@@ -248,7 +346,7 @@ void HSV_to_RGB(float h, float s, float v, byte &r, byte &g, byte &b) {
 
 	if (s == 0) {
 		// Achromatic (grey)
-		r = g = b = round(v*8);
+		r = g = b = round(v*255);
 		return;
 	}
 
@@ -259,13 +357,13 @@ void HSV_to_RGB(float h, float s, float v, byte &r, byte &g, byte &b) {
 	q = v * (1.0 - s * f);
 	t = v * (1.0 - s * (1 - f));
 	switch(i) {
-	case 0: r = round(8*v); g = round(8*t);	b = round(8*p);	break;
-	case 1: r = round(8*q);	g = round(8*v);	b = round(8*p);	break;
-	case 2: r = round(8*p);	g = round(8*v);	b = round(8*t);	break;
-	case 3:	r = round(8*p);	g = round(8*q);	b = round(8*v);	break;
-	case 4:	r = round(8*t);	g = round(8*p);	b = round(8*v);	break;
+	case 0: r = round(255*v); g = round(255*t);	b = round(255*p);	break;
+	case 1: r = round(255*q);	g = round(255*v);	b = round(255*p);	break;
+	case 2: r = round(255*p);	g = round(255*v);	b = round(255*t);	break;
+	case 3:	r = round(255*p);	g = round(255*q);	b = round(255*v);	break;
+	case 4:	r = round(255*t);	g = round(255*p);	b = round(255*v);	break;
 	default: // case 5:
-		r = round(8*v);	g = round(8*p);	b = round(8*q);
+		r = round(255*v);	g = round(255*p);	b = round(255*q);
 	}
 }
 
@@ -293,29 +391,74 @@ void vibrate_on() {
 	digitalWrite(VIBRATE_ENABLE, HIGH);
 }
 
+//Number of 8 second sleeps since boot, and when the watchdog was last calibrated
+unsigned long sleep_count = 0;
+static unsigned long calibrated_at = 0;
+static boolean calibrated = false;
+
 //Shut down everything and go into deep sleep for a long time.
 //Will delay for (time * 8) seconds
 void power_sleep_long(int time) {
-	//Turn everything off
-	Serial.end();
+	unsigned long start_us;
+
+	//Measure the watchdog before the first sleep (not at boot, where it would hold up the first
+	//orientation check), then re-measure every so often, as its period drifts with temperature
+	if(!calibrated || sleep_count - calibrated_at >= CLOCK_CALIBRATION_SLEEPS) {
+		clock_calibrate();
+		calibrated_at = sleep_count;
+		calibrated = true;
+	}
+
+	//Turn everything off. Each of these releases its peripherals from the power manager.
+	start_us = micros();
+	serial_off();
 	stop_led_scanner();
 	disable_sensors();
 	vibrate_off();
 	noTone(PIEZO_PIN_1);
 
-	//Tristate and disable pullups on all pins for power saving
-	for(int i = 0; i <= 21; i++) {
-		pinMode(i, INPUT);
-		digitalWrite(i, LOW);
-	}
-
-	//And a few further tweaks. Each of these DO save uA. We measured.
-	ADCSRA = 0; //ADCs
-	power_adc_disable();
+	//Tristate and disable pullups on all pins (digital 0 to 13 and A0 to A5) for power saving.
+	//Done on the ports directly, rather than 44 pinMode() and digitalWrite() calls.
+	//PB6/7 are the crystal and PC6 is reset, so are left alone.
+	DDRB &= ~0x3F;
+	PORTB &= ~0x3F;
+	DDRC &= ~0x3F;
+	PORTC &= ~0x3F;
+	DDRD = 0;
+	PORTD = 0;
+
+	//And a further tweak, which DOES save uA. We measured.
 	ACSR = B10000000; //Analogue comparator
-	//PRR = B11111111; //Internal peripheral power down register
-	MCUCR = _BV (BODS) | _BV (BODSE); //Brownout detector (This may have no effect, as we nuked the e-fuses to disable the BDD. But it can't hurt.)
-	MCUCR = _BV (BODS);
-
+	//The internal peripherals are gated in PRR by the power manager as soon as they are released.
+	//The ADC is already disabled as well (peripherals_init() and battery_measure_mv()), and a write
+	//to it here would be ignored anyway.
+	//Timer0 keeps running for millis(), but it stops with the main clock in power-down anyway.
+	//The brownout detector is disabled by Narcoleptic immediately before each sleep, as BODS only
+	//lasts for a few cycles. (This may have no effect, as we nuked the e-fuses to disable the BDD.)
+
+	//All of the above is done once, however long the sleep. The intermediate watchdog wakes do nothing but go back to sleep.
+	//Timer0 only counts while the processor is awake, so micros() across the sleep is the time spent in those wakes
+	//(less the oscillator start-up, during which nothing is clocked).
+	sleep_entry_us = micros() - start_us;
+	start_us = micros();
 	Narcoleptic.delay8secs(time);
+	sleep_awake_us = micros() - start_us;
+	sleep_slices = time;
+	sleep_count += time;
+	clock_slept(time);
+}
+
+//Stay awake for (time * 8) seconds serving the command shell, in place of power_sleep_long() while a host is attached
+void awake_wait(int time) {
+	unsigned long start = millis();
+
+	stop_led_scanner();
+	disable_sensors();
+	vibrate_off();
+	noTone(PIEZO_PIN_1);
+
+	while(millis() - start < time * 8000UL) {
+		shell_poll();
+	}
+	sleep_count += time;
 }
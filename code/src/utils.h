@@ -2,26 +2,31 @@
 #define __UTILS_H_
 
 #include "leds.h"
+#include "ADXL345.h"
 
 int enable_sensors();
 void disable_sensors();
 boolean gather_entropy();
 void calibration();
+void calibrate_magnetometer();
+void calibrate_leds();
 void refresh_sensors();
+unsigned char sample_accel_window(AccelerometerRaw *buf, unsigned char count);
 
-//Configuration
-void clear_eeprom();
-void write_bearing(int bearing);
-int read_bearing();
-void write_calibration(int *buf);
-void read_calibration(int *buf);
+extern unsigned long sensor_bringup_us;
+extern unsigned long first_heading_us;
+extern unsigned long sleep_entry_us;
+extern unsigned long sleep_awake_us;
+extern unsigned int sleep_slices;
 
 void HSV_to_RGB(float h, float s, float v, byte &r, byte &g, byte &b);
 Colour HSV_to_RGB(float h, float s, float v);
 
 void power_sleep_long(int time);
+void awake_wait(int time);
+extern unsigned long sleep_count;
 
 void vibrate_on();
 void vibrate_off();
 
-#endif
+#endif
@@ -0,0 +1,78 @@
+#!/usr/bin/env python
+"""
+Decode the JaCube event log.
+
+Capture the output of the shell's log command (everything between the EVENTLOG
+and END lines, see src/shell.cpp) and pass it to this script, either as a file or
+on stdin:
+
+    python decode_eventlog.py capture.txt
+
+Each entry is 6 bytes: type (bits 0-6) and lap bit, argument, 24 bit timestamp in
+8 second units, CRC8. See src/eventlog.cpp.
+"""
+
+import sys
+
+EVENTS = {
+    1: ("BOOT", None),
+    2: ("UNHAPPY", None),
+    3: ("CALMED", "after {} s"),
+    4: ("APOPLEXY", None),
+    5: ("APOPLEXY_END", "after {} sleeps of 8 s"),  # Older firmware
+    6: ("PACIFIED", None),
+    7: ("SENSOR_RETRIES", "{} attempts"),
+    8: ("NOSE_CHANGE", "new nose {}"),
+    9: ("BATTERY_FLAT", lambda arg: "at {} mV".format(arg * 20)),
+    10: ("APOPLEXY_ENDED", "after {} min"),
+}
+
+
+def crc8_ccitt(data):
+    crc = 0
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+def format_time(eights):
+    secs = eights * 8
+    return "{:4d}d {:02d}:{:02d}:{:02d}".format(secs // 86400, secs // 3600 % 24, secs // 60 % 60, secs % 60)
+
+
+def decode(lines):
+    inlog = False
+    for line in lines:
+        line = line.strip()
+        if line == "EVENTLOG":
+            inlog = True
+            continue
+        if line == "END":
+            break
+        if not inlog or not line:
+            continue
+
+        e = [int(b, 16) for b in line.split()]
+        if len(e) != 6 or crc8_ccitt(e[:5]) != e[5]:
+            print("(bad entry: {})".format(line))
+            continue
+
+        etype = e[0] & 0x7F
+        arg = e[1]
+        t = e[2] | (e[3] << 8) | (e[4] << 16)
+        name, fmt = EVENTS.get(etype, ("UNKNOWN({})".format(etype), "arg {}"))
+        if callable(fmt):
+            detail = fmt(arg)
+        else:
+            detail = fmt.format(arg) if fmt else ""
+        print("{}  {:16s} {}".format(format_time(t), name, detail).rstrip())
+
+
+if __name__ == "__main__":
+    if len(sys.argv) > 1:
+        with open(sys.argv[1]) as f:
+            decode(f)
+    else:
+        decode(sys.stdin)
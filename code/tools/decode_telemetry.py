@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+"""
+Decode the JaCube binary telemetry stream into CSV.
+
+Build the firmware with DEBUG set to 1 in options.h and record the serial line
+(115200 baud, raw) to a file, then:
+
+    python decode_telemetry.py capture.bin > sensors.csv
+
+or decode live, e.g. on Linux:
+
+    stty -F /dev/ttyUSB0 115200 raw && python decode_telemetry.py /dev/ttyUSB0
+
+Sensor snapshots are written as CSV to stdout. Log messages (see src/tokenlog.h),
+events (see src/eventlog.h) and a count of bad frames and sequence gaps go to
+stderr. Log messages are looked up in a dictionary from extract_log_strings.py,
+given with --dict, or extracted from the sources alongside this script.
+
+Frames are COBS encoded and end with a zero byte. Decoded, each is type, sequence
+number, payload and CRC8. See src/telemetry.cpp.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+from decode_eventlog import EVENTS, crc8_ccitt
+import extract_log_strings
+
+TELEMETRY_SENSORS = 1
+TELEMETRY_EVENT = 2
+TELEMETRY_LOG = 3
+
+SENSOR_FORMAT = "<I3h3hhBBBBHHB"
+SENSOR_FIELDS = ["millis", "acc_x", "acc_y", "acc_z", "mag_x", "mag_y", "mag_z", "heading",
+                 "confidence", "top", "nose", "state", "loop_us", "bringup_us", "dropped"]
+
+STATES = ["sleeping", "happy_check", "animating", "unhappy", "apoplectic", "pacified"]
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return out
+
+
+def frames(stream):
+    buf = bytearray()
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            return
+        for b in bytearray(chunk):
+            if b == 0:
+                if buf:
+                    yield bytes(buf)
+                buf = bytearray()
+            else:
+                buf.append(b)
+
+
+def format_log(messages, payload):
+    msgid = struct.unpack("<H", payload[:2])[0]
+    args = list(struct.unpack("<{}i".format((len(payload) - 2) // 4), payload[2:]))
+    msg = messages.get(msgid)
+    if msg is None:
+        return "log {} (not in dictionary) {}".format(msgid, args)
+    #Arguments all arrive as signed longs, so unsigned conversions need masking
+    specs = re.findall(r"%[-+ #0-9.]*[hlL]*([diouxXc%])", msg["format"])
+    specs = [s for s in specs if s != "%"]
+    for i, spec in enumerate(specs[:len(args)]):
+        if spec in "ouxX":
+            args[i] &= 0xFFFFFFFF
+    try:
+        return msg["format"] % tuple(args)
+    except (TypeError, ValueError):
+        return "{} {}".format(msg["format"], args)
+
+
+def decode(stream, messages, out=sys.stdout, err=sys.stderr):
+    bad = 0
+    gaps = 0
+    last_seq = None
+    out.write(",".join(SENSOR_FIELDS + ["state_name"]) + "\n")
+
+    for frame in frames(stream):
+        raw = cobs_decode(bytearray(frame))
+        if raw is None or len(raw) < 3 or crc8_ccitt(raw[:-1]) != raw[-1]:
+            bad += 1
+            continue
+        ftype, seq, payload = raw[0], raw[1], bytes(raw[2:-1])
+        if last_seq is not None and seq != (last_seq + 1) & 0xFF:
+            gaps += 1
+        last_seq = seq
+
+        if ftype == TELEMETRY_SENSORS and len(payload) == struct.calcsize(SENSOR_FORMAT):
+            values = struct.unpack(SENSOR_FORMAT, payload)
+            state = values[SENSOR_FIELDS.index("state")]
+            name = STATES[state] if state < len(STATES) else str(state)
+            out.write(",".join(str(v) for v in values) + "," + name + "\n")
+        elif ftype == TELEMETRY_EVENT and len(payload) == 2:
+            etype, arg = bytearray(payload)
+            name = EVENTS.get(etype, ("UNKNOWN({})".format(etype), None))[0]
+            err.write("event {} arg {}\n".format(name, arg))
+        elif ftype == TELEMETRY_LOG and len(payload) >= 2 and len(payload) % 4 == 2:
+            err.write(format_log(messages, payload) + "\n")
+        else:
+            bad += 1
+
+    err.write("{} bad frames, {} sequence gaps\n".format(bad, gaps))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Decode the JaCube telemetry stream into CSV")
+    parser.add_argument("capture", nargs="?", help="recorded stream or serial device (default stdin)")
+    parser.add_argument("--dict", help="log message dictionary from extract_log_strings.py")
+    args = parser.parse_args()
+
+    messages = extract_log_strings.load(args.dict)
+    if args.capture:
+        with open(args.capture, "rb") as f:
+            decode(f, messages)
+    else:
+        decode(getattr(sys.stdin, "buffer", sys.stdin), messages)
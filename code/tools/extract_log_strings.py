@@ -0,0 +1,77 @@
+#!/usr/bin/env python
+"""
+Build the dictionary of tokenised log messages (see src/tokenlog.h).
+
+Scans the firmware sources for LOGn() calls and writes each message ID with its
+format string, file and line as JSON:
+
+    python extract_log_strings.py > logstrings.json
+
+Run it on the same sources the firmware was built from. decode_telemetry.py runs
+it itself if no dictionary is given. Exits non-zero if a call cannot be given an
+ID (no LOG_FILE, a duplicate LOG_FILE, or two calls on one line).
+"""
+
+import glob
+import json
+import os
+import re
+import sys
+
+SRC = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src")
+
+LOG_FILE_RE = re.compile(r"^#define LOG_FILE (\d+)", re.M)
+LOG_CALL_RE = re.compile(r"\bLOG([0-3])\(\s*\"((?:[^\"\\]|\\.)*)\"")
+
+
+def extract(src=SRC):
+    messages = {}
+    errors = []
+    files = {}
+    for path in sorted(glob.glob(os.path.join(src, "*.cpp"))):
+        name = os.path.basename(path)
+        with open(path) as f:
+            text = f.read()
+        m = LOG_FILE_RE.search(text)
+        calls = [(n + 1, LOG_CALL_RE.findall(line)) for n, line in enumerate(text.split("\n"))
+                 if not line.lstrip().startswith("//")]
+        calls = [(n, c) for n, c in calls if c]
+        if not calls:
+            continue
+        if not m:
+            errors.append("{}: logs without defining LOG_FILE".format(name))
+            continue
+        fid = int(m.group(1))
+        if fid in files or not 1 <= fid <= 31:
+            errors.append("{}: LOG_FILE {} is out of range or used by {}".format(name, fid, files.get(fid)))
+            continue
+        files[fid] = name
+        for line, found in calls:
+            if len(found) > 1:
+                errors.append("{}:{}: more than one LOG call on the line".format(name, line))
+            if line > 2047:
+                errors.append("{}:{}: LOG call beyond line 2047".format(name, line))
+            nargs, fmt = found[0]
+            messages[(fid << 11) | line] = {"file": name, "line": line, "args": int(nargs),
+                                            "format": fmt.encode().decode("unicode_escape")}
+    return messages, errors
+
+
+def load(path=None):
+    """The dictionary from a JSON file, or freshly extracted from the sources."""
+    if path:
+        with open(path) as f:
+            return dict((int(k), v) for k, v in json.load(f).items())
+    messages, errors = extract()
+    for e in errors:
+        sys.stderr.write(e + "\n")
+    return messages
+
+
+if __name__ == "__main__":
+    messages, errors = extract()
+    for e in errors:
+        sys.stderr.write(e + "\n")
+    json.dump(dict((str(k), v) for k, v in sorted(messages.items())), sys.stdout, indent=1, sort_keys=True)
+    sys.stdout.write("\n")
+    sys.exit(1 if errors else 0)
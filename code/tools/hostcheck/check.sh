@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Build and run the host checks of the firmware modules.
+#
+# Each check_*.cpp is built with g++ against the stand-in Arduino and AVR headers in host/,
+# together with the firmware sources named on its "//Sources:" line (relative to code/) and
+# any compiler flags on its "//Flags:" line.
+# The checks print what failed and exit non-zero, as does this script if any of them fail.
+# Run with no arguments it also checks that tools/simulate_behaviour.py is in step with the firmware.
+#
+#     tools/hostcheck/check.sh            run every check
+#     tools/hostcheck/check.sh filter     run check_filter.cpp only
+#
+# The checks run in a scratch directory. Files named in the environment for them to write
+# (e.g. CAPTURE for check_capture.cpp) are relative to where this script is run from.
+#
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+CODE=$(cd "$HERE/../.." && pwd)
+CXX=${CXX:-g++}
+PYTHON=${PYTHON:-python3}
+CXXFLAGS="-std=gnu++98 -O1 -g -Wall -Wno-unused-variable -Wno-unused-but-set-variable -Wno-int-to-pointer-cast"
+INCLUDES="-I$HERE/host -I$CODE/src -I$CODE/lib -I$CODE/arduinolib"
+case "$CAPTURE" in
+"" | /*) ;;
+*) export CAPTURE="$PWD/$CAPTURE" ;;
+esac
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+if [ $# -gt 0 ]; then
+	CHECKS=""
+	for name in "$@"; do CHECKS="$CHECKS $HERE/check_$name.cpp"; done
+else
+	CHECKS=$(ls "$HERE"/check_*.cpp)
+fi
+
+failed=0
+for check in $CHECKS; do
+	name=$(basename "$check" .cpp)
+	sources=$(sed -n 's|^//Sources:||p' "$check")
+	flags=$(sed -n 's|^//Flags:||p' "$check")
+	paths=""
+	for s in $sources; do paths="$paths $CODE/$s"; done
+
+	echo "== $name"
+	if ! $CXX $CXXFLAGS $INCLUDES $flags -o "$OUT/$name" "$check" "$HERE/host/host.cpp" $paths -lm; then
+		echo "$name: build failed"
+		failed=1
+	elif ! (cd "$OUT" && "./$name"); then
+		failed=1
+	fi
+done
+
+if [ $# -eq 0 ]; then
+	echo "== simulate_behaviour.py --check"
+	"$PYTHON" "$CODE/tools/simulate_behaviour.py" --check || failed=1
+fi
+
+exit $failed
@@ -0,0 +1,42 @@
+/*
+ * Boot (jacube.cpp and behaviour.cpp): from reset to the first happy/unhappy decision, with no
+ * host attached, fits in BOOT_BUDGET_MS of the stub clock, the one millis() reads for the
+ * "Reset to first decision ms" log message. The decision is when gather_entropy() is called.
+ */
+//Sources: src/jacube.cpp src/behaviour.cpp src/animations.cpp src/battery.cpp src/capture.cpp src/compass.cpp src/config.cpp src/entropy.cpp src/eventlog.cpp src/leds.cpp src/peripherals.cpp src/RTTTL.cpp src/shell.cpp src/telemetry.cpp src/timekeeping.cpp src/tokenlog.cpp src/utils.cpp lib/ADXL345.cpp lib/HMC5883L.cpp lib/TimerOne.cpp arduinolib/EEPROM.cpp tools/hostcheck/host/board.cpp
+//Flags: -Wl,--wrap=_Z14gather_entropyv
+
+#include "host.h"
+#include "options.h"
+#include "behaviour.h"
+#include "peripherals.h"
+
+//The old boot waited a second at the serial prompt alone
+#define BOOT_BUDGET_MS 100
+
+void setup();
+
+static unsigned long decided_us = 0;
+static unsigned int decisions = 0;
+
+extern "C" boolean __real__Z14gather_entropyv();
+
+extern "C" boolean __wrap__Z14gather_entropyv() {
+	if(decisions++ == 0) decided_us = host_us;
+	return __real__Z14gather_entropyv();
+}
+
+int main() {
+	host_poll_us = 20;
+
+	setup();
+	CHECK(!serial_is_on());
+	behaviour_init();
+	behaviour_step();
+
+	CHECK(decisions == 1);
+	CHECK(decided_us > 0 && decided_us < BOOT_BUDGET_MS * 1000UL);
+	fprintf(stderr, "reset to first decision %.1f ms of %u\n", decided_us / 1000.0, BOOT_BUDGET_MS);
+
+	return host_done();
+}
@@ -0,0 +1,197 @@
+/*
+ * Animation capture without a cube: the firmware built with ANIMATION_CAPTURE and the LED
+ * scanner on MockPin pins boots as on the cube and plays every happy animation through
+ * play_animation(), with the scanner run from the Timer1 interrupt on simulated time. Every
+ * animation is captured, and the light the scanner puts out from each frame to the next is
+ * what the frame records.
+ *
+ * Set CAPTURE to keep the capture for tools/render_capture.py. Runs are repeatable, so this
+ * is also how golden frame files are made and compared:
+ *
+ *     CAPTURE=capture.txt tools/hostcheck/check.sh capture
+ *     python tools/render_capture.py capture.txt out/ --golden golden/
+ */
+//Sources: src/jacube.cpp src/animations.cpp src/behaviour.cpp src/battery.cpp src/capture.cpp src/compass.cpp src/config.cpp src/entropy.cpp src/eventlog.cpp src/leds.cpp src/peripherals.cpp src/RTTTL.cpp src/shell.cpp src/telemetry.cpp src/timekeeping.cpp src/tokenlog.cpp src/utils.cpp lib/ADXL345.cpp lib/HMC5883L.cpp lib/TimerOne.cpp arduinolib/EEPROM.cpp tools/hostcheck/host/board.cpp
+//Flags: -DLED_PIN=MockPin -DANIMATION_CAPTURE
+
+//Before the Arduino min() and max() macros
+#include <string>
+#include <vector>
+#include "host.h"
+#include "options.h"
+#include "ledscanner.h"
+#include "behaviour.h"
+#include "leds.h"
+
+void setup();
+
+//The same scanner as leds.cpp, so the same frame buffer
+typedef LedScanner<LED_ANODES, LED_CATHODES, LED_SCANMAX, LED_SCANNER_RATE_US, LED_GROUP_MAX> Scanner;
+
+//Light put out by each channel of each LED so far, in microseconds at full brightness
+static unsigned long long light[NUMLEDS][3];
+static unsigned long light_us = 0;
+
+template<class Pin> static boolean sourcing() {
+	return Pin::driven && Pin::level;
+}
+
+template<class Pin> static boolean sinking() {
+	return Pin::driven && !Pin::level;
+}
+
+static void anodes_on(const PinListEnd &, unsigned char, unsigned char &) {
+}
+
+template<class Pin, class Next> static void anodes_on(const PinList<Pin, Next> &, unsigned char bit, unsigned char &mask) {
+	if(sourcing<Pin>()) mask |= bit;
+	anodes_on(Next(), bit << 1, mask);
+}
+
+//The pins only change in the scanner interrupt, so they have been as they are now since the last call
+static void integrate() {
+	typedef LED_CATHODES Cathodes;
+	boolean cathode[3] = {sinking<Cathodes::Red>(), sinking<Cathodes::Green>(), sinking<Cathodes::Blue>()};
+	unsigned char anodes = 0;
+
+	anodes_on(LED_ANODES(), 1, anodes);
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		for(unsigned char ch = 0; ch < 3; ch++) {
+			if((anodes & (1 << i)) && cathode[ch]) light[i][ch] += host_us - light_us;
+		}
+	}
+	light_us = host_us;
+}
+
+//---------------------------------------------------------------------------------
+// The capture, read from the serial line as it is written
+
+typedef struct {
+	int anim;
+	unsigned long us;
+	unsigned char value[NUMLEDS][3];
+	unsigned long long light[NUMLEDS][3];
+	boolean dithered; //Some LED is dithered, so is only on average as recorded
+	boolean fading; //Some LED is fading, so moves on from what was recorded before the next frame
+} Frame;
+
+static std::string capture, line;
+static std::vector<Frame> frames;
+static int anim = -1;
+static int anims_begun = 0, anims_ended = 0, tones = 0;
+static boolean in_order = true;
+
+static void capture_line() {
+	if(line.compare(0, 5, "ANIM ") == 0) {
+		anim = strtol(line.c_str() + 5, NULL, 16);
+		in_order &= anim == anims_begun;
+		anims_begun++;
+	} else if(line.compare(0, 2, "F ") == 0) {
+		Frame f;
+		const char *p = strchr(line.c_str() + 2, ' ');
+		f.anim = anim;
+		f.us = host_us;
+		f.dithered = Scanner::is_dithered();
+		f.fading = leds_fading();
+		integrate();
+		memcpy(f.light, light, sizeof(light));
+		for(unsigned char i = 0; p != NULL && i < NUMLEDS * 3; i++) {
+			char hex[3] = {p[1 + 2 * i], p[2 + 2 * i], 0};
+			f.value[i / 3][i % 3] = strtol(hex, NULL, 16);
+		}
+		frames.push_back(f);
+	} else if(line.compare(0, 2, "T ") == 0) {
+		tones++;
+	} else if(line == "END") {
+		anims_ended++;
+	}
+}
+
+static ssize_t serial_write(void *cookie, const char *buf, size_t size) {
+	for(size_t i = 0; i < size; i++) {
+		capture += buf[i];
+		if(buf[i] == '\n') {
+			capture_line();
+			line.clear();
+		} else if(buf[i] != '\r') {
+			line += buf[i];
+		}
+	}
+	return size;
+}
+
+//---------------------------------------------------------------------------------
+
+int main() {
+	cookie_io_functions_t io = {NULL, serial_write, NULL, NULL};
+
+	host_serial_out = fopencookie(NULL, "w", io);
+	setvbuf(host_serial_out, NULL, _IONBF, 0);
+	host_timer1_hook = integrate;
+	host_poll_us = 20; //Roughly one pass of play_animation()'s loop when there is nothing to do
+
+	//Boot as on the cube, which plays the capture
+	setup();
+	fclose(host_serial_out);
+
+	CHECK(in_order);
+	CHECK(anims_begun == HAPPY_ANIM_COUNT);
+	CHECK(anims_ended == HAPPY_ANIM_COUNT);
+	CHECK(tones > 0);
+
+	//Compare the light over each run of identical frames lasting at least a tick with the frames.
+	//Each LED has one slot in NUMLEDS at every scan level, so a level is on for
+	//level / (LED_SCANMAX * NUMLEDS) of the time. Errors are in units of full brightness, and
+	//allow for the run not being a whole number of PWM cycles. Frames record the colours asked
+	//for, so a dithered LED is within half a level of its frame (an 8 bit colour is rounded to
+	//the nearest level), and a fading one moves on from its frame, so is only within a level.
+	unsigned int frames_seen[HAPPY_ANIM_COUNT] = {0};
+	unsigned long steady_us = 0, total_us = 0;
+	double worst = 0, worst_exact = 0, worst_dithered = 0;
+	for(size_t k = 0; k < frames.size(); k++) {
+		if(frames[k].anim >= 0 && frames[k].anim < HAPPY_ANIM_COUNT) frames_seen[frames[k].anim]++;
+		if(k + 1 < frames.size() && frames[k + 1].anim == frames[k].anim) total_us += frames[k + 1].us - frames[k].us;
+	}
+	for(size_t k = 0, j; k < frames.size(); k = j) {
+		boolean dithered = frames[k].dithered, fading = frames[k].fading;
+		for(j = k + 1; j < frames.size() && frames[j].anim == frames[k].anim; j++) {
+			if(memcmp(frames[j].value, frames[k].value, sizeof(frames[k].value)) != 0) break;
+			dithered |= frames[j].dithered;
+			fading |= frames[j].fading;
+		}
+		if(j == frames.size() || frames[j].anim != frames[k].anim) continue;
+
+		unsigned long us = frames[j].us - frames[k].us;
+		if(us < TICK_MS * 1000UL) continue;
+		steady_us += us;
+		for(unsigned char i = 0; i < NUMLEDS; i++) {
+			for(unsigned char ch = 0; ch < 3; ch++) {
+				double expected = min(frames[k].value[i][ch], LED_SCANMAX) / (double) LED_SCANMAX;
+				double measured = (frames[j].light[i][ch] - frames[k].light[i][ch]) * NUMLEDS / (double) us;
+				double error = fabs(measured - expected);
+				worst = max(worst, error);
+				if(!fading && dithered) worst_dithered = max(worst_dithered, error);
+				if(!fading && !dithered) worst_exact = max(worst_exact, error);
+			}
+		}
+	}
+	for(unsigned char i = 0; i < HAPPY_ANIM_COUNT; i++) CHECK(frames_seen[i] > 0);
+	CHECK(steady_us > total_us / 4);
+	CHECK(worst_exact < 0.05);
+	CHECK(worst_dithered < 0.5 / LED_SCANMAX + 0.05);
+	CHECK(worst < 1.0 / LED_SCANMAX + 0.05);
+	fprintf(stderr, "%u frames, steady for %lu of %lu ms, worst light error %.3f of full brightness (%.3f dithered, %.3f fading)\n",
+			(unsigned int) frames.size(), steady_us / 1000, total_us / 1000, worst_exact, worst_dithered, worst);
+
+	const char *file = getenv("CAPTURE");
+	if(file != NULL) {
+		FILE *out = fopen(file, "w");
+		CHECK(out != NULL);
+		if(out != NULL) {
+			fputs(capture.c_str(), out);
+			fclose(out);
+		}
+	}
+
+	return host_done();
+}
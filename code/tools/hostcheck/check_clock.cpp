@@ -0,0 +1,91 @@
+/*
+ * Virtual wall clock (timekeeping.cpp): with a watchdog running well off its nominal period,
+ * and drifting, the uptime still follows true time across a day of 8 second sleeps.
+ */
+//Sources: src/timekeeping.cpp
+
+#include "host.h"
+#include "options.h"
+#include "timekeeping.h"
+#include "Narcoleptic.h"
+
+NarcolepticClass Narcoleptic;
+
+//The watchdog's true 500ms period, in microseconds. 12% slow to start with.
+static unsigned long wdt500_us = 560000;
+
+//Timing a period keeps the processor idling, so millis() runs meanwhile
+unsigned long NarcolepticClass::measureWatchdog(uint8_t wdt_period) {
+	host_advance_us(wdt500_us);
+	return wdt500_us;
+}
+
+//True time since boot, in milliseconds
+static unsigned long long true_ms = 0;
+
+static void awake(unsigned long ms) {
+	host_advance_ms(ms);
+	true_ms += ms;
+}
+
+//As power_sleep_long(1): the processor and millis() stop for one watchdog period
+static void sleep8(unsigned long *sleeps, unsigned long *calibrated_at) {
+	if(*sleeps - *calibrated_at >= CLOCK_CALIBRATION_SLEEPS) {
+		true_ms += wdt500_us / 1000;
+		clock_calibrate();
+		*calibrated_at = *sleeps;
+	}
+	true_ms += wdt500_us * 16 / 1000;
+	clock_slept(1);
+	(*sleeps)++;
+}
+
+static long error_s() {
+	return (long) uptime_seconds() - (long) (true_ms / 1000);
+}
+
+int main() {
+	const unsigned long day = 86400000UL;
+	unsigned long sleeps = 0, calibrated_at = 0;
+	unsigned long previous = 0;
+	boolean monotonic = true;
+
+	//Calibrated before the first sleep
+	clock_calibrate();
+	true_ms += wdt500_us / 1000;
+	CHECK(wdt_period_ms() == 8960);
+
+	//A day of checking the orientation for 50ms between sleeps
+	while(true_ms < day) {
+		awake(50);
+		sleep8(&sleeps, &calibrated_at);
+		monotonic &= uptime_seconds() >= previous;
+		previous = uptime_seconds();
+	}
+	CHECK(monotonic);
+	CHECK(labs(error_s()) <= 1);
+
+	//Counting sleeps as 8 seconds would be over 2.5 hours out
+	unsigned long counted_s = sleeps * 8 + millis() / 1000;
+	CHECK(true_ms / 1000 - counted_s > 9000);
+
+	//The watchdog warms up to 9% slow. Until the next calibration the clock runs ahead by
+	//240ms per sleep, after which it follows true time again.
+	long before = error_s();
+	wdt500_us = 545000;
+	for(unsigned long i = 0; i < 3 * CLOCK_CALIBRATION_SLEEPS; i++) {
+		awake(50);
+		sleep8(&sleeps, &calibrated_at);
+	}
+	long drift = error_s() - before;
+	CHECK(drift >= 0 && drift <= (long) (CLOCK_CALIBRATION_SLEEPS * 240 / 1000 + 2));
+	CHECK(wdt_period_ms() == 8720);
+	before = error_s();
+	for(unsigned long i = 0; i < CLOCK_CALIBRATION_SLEEPS; i++) {
+		awake(50);
+		sleep8(&sleeps, &calibrated_at);
+	}
+	CHECK(labs(error_s() - before) <= 1);
+
+	return host_done();
+}
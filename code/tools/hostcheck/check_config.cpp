@@ -0,0 +1,136 @@
+/*
+ * Configuration store (config.cpp): records survive a reload, a torn save falls back to the
+ * previous record, older layouts are migrated, and saves are spread over the ring.
+ */
+//Sources: src/config.cpp arduinolib/EEPROM.cpp
+
+#include "host.h"
+#include "config.h"
+#include "compass.h"
+#include "leds.h"
+#include <stddef.h>
+#include <util/crc16.h>
+
+#define V1_SLOT_SIZE 40
+#define V1_FIELDS offsetof(ConfigRecord, led_scale)
+#define V2_FIELDS offsetof(ConfigRecord, bandgap_mv)
+
+static uint16_t crc_bytes(const void *p, unsigned char len) {
+	uint16_t crc = 0xFFFF;
+	for(unsigned char i = 0; i < len; i++) crc = _crc_ccitt_update(crc, ((const uint8_t *) p)[i]);
+	return crc;
+}
+
+int main() {
+	ConfigRecord saved;
+
+	//A new cube has the defaults
+	host_eeprom_erase();
+	CHECK(!load_config());
+	CHECK(config.bearing == 0);
+	CHECK(config.mag_calibration[3] == MAG_SCALE_ONE);
+	CHECK(config.apoplexy_sleep == DEFAULT_APOPLEXY_SLEEP_8SECS);
+	CHECK(config.led_scale[NUMLEDS - 1][2] == LED_SCALE_ONE);
+	CHECK(config.bandgap_mv == BANDGAP_MV);
+
+	//One which only has the bearing byte of the oldest layout keeps its bearing
+	host_eeprom[0] = 123;
+	CHECK(!load_config());
+	CHECK(config.bearing == 123);
+
+	//Saved records are reloaded
+	host_eeprom_erase();
+	load_config();
+	config.bearing = 271;
+	config.mag_calibration[0] = -80;
+	config.apoplexy_sleep = 1234;
+	config.led_scale[2][1] = 200;
+	config.bandgap_mv = 1043;
+	save_config();
+	saved = config;
+	default_config(&config);
+	CHECK(load_config());
+	CHECK(memcmp(&config, &saved, sizeof(config)) == 0);
+
+	//A save torn part way through leaves the previous record in use
+	config.bearing = 90;
+	unsigned char before[E2END + 1];
+	memcpy(before, host_eeprom, sizeof(before));
+	save_config();
+	for(int addr = CONFIG_RING_START + 2 * CONFIG_SLOT_SIZE - 10; addr < CONFIG_RING_END; addr++) {
+		host_eeprom[addr] = before[addr];
+	}
+	CHECK(load_config());
+	CHECK(config.bearing == 271);
+
+	//And the next save goes after it and is loaded in preference
+	config.bearing = 45;
+	save_config();
+	CHECK(load_config());
+	CHECK(config.bearing == 45);
+
+	//A version 1 record (no LED scales, slots of 40 bytes) is migrated with the LEDs unscaled
+	ConfigRecord v1;
+	host_eeprom_erase();
+	default_config(&v1);
+	v1.version = 1;
+	v1.sequence = 7;
+	v1.bearing = 200;
+	v1.nose_anims_min = 3;
+	uint16_t v1_crc = crc_bytes(&v1, V1_FIELDS);
+	memcpy(&host_eeprom[3 * V1_SLOT_SIZE], &v1, V1_FIELDS);
+	memcpy(&host_eeprom[3 * V1_SLOT_SIZE + V1_FIELDS], &v1_crc, sizeof(v1_crc));
+	CHECK(!load_config());
+	CHECK(config.bearing == 200);
+	CHECK(config.nose_anims_min == 3);
+	CHECK(config.led_scale[0][0] == LED_SCALE_ONE);
+	save_config();
+	CHECK(load_config());
+	CHECK(config.version == CONFIG_VERSION && config.bearing == 200);
+
+	//As is a version 2 record (no bandgap calibration), newer than a version 1 record alongside it
+	ConfigRecord v2;
+	default_config(&v2);
+	v2.version = 2;
+	v2.sequence = 9;
+	v2.bearing = 310;
+	v2.led_scale[4][0] = 180;
+	v2.bandgap_mv = 0;
+	uint16_t v2_crc = crc_bytes(&v2, V2_FIELDS);
+	host_eeprom_erase();
+	memcpy(&host_eeprom[3 * V1_SLOT_SIZE], &v1, V1_FIELDS);
+	memcpy(&host_eeprom[3 * V1_SLOT_SIZE + V1_FIELDS], &v1_crc, sizeof(v1_crc));
+	memcpy(&host_eeprom[5 * CONFIG_SLOT_SIZE], &v2, V2_FIELDS);
+	memcpy(&host_eeprom[5 * CONFIG_SLOT_SIZE + V2_FIELDS], &v2_crc, sizeof(v2_crc));
+	CHECK(!load_config());
+	CHECK(config.bearing == 310);
+	CHECK(config.led_scale[4][0] == 180);
+	CHECK(config.bandgap_mv == BANDGAP_MV);
+	save_config();
+	CHECK(load_config());
+	CHECK(config.version == CONFIG_VERSION && config.bearing == 310 && config.sequence == 10);
+
+	//Wear: 1001 saves, each changing a field. The sequence number wraps several times, and no
+	//cell is written more often than its slot is used.
+	host_eeprom_erase();
+	load_config();
+	for(int i = 0; i <= 1000; i++) {
+		config.bearing = i % 360;
+		save_config();
+	}
+	CHECK(load_config());
+	CHECK(config.bearing == 1000 % 360);
+	unsigned long worst = 0;
+	for(int addr = 0; addr <= E2END; addr++) worst = max(worst, host_eeprom_writes[addr]);
+	CHECK(worst <= (1001 + CONFIG_SLOTS - 1) / CONFIG_SLOTS);
+	unsigned long outside = 0;
+	for(int addr = CONFIG_RING_END; addr <= E2END; addr++) outside += host_eeprom_writes[addr];
+	CHECK(outside == 0);
+
+	//Clearing goes back to the defaults
+	clear_config();
+	CHECK(!load_config());
+	CHECK(config.bearing == 0);
+
+	return host_done();
+}
@@ -0,0 +1,133 @@
+/*
+ * Entropy pool and PRNG (entropy.cpp): the von Neumann filter removes the bias of the raw bits,
+ * and random8() and random16() are uniform over their ranges and never leave them.
+ */
+//Sources: src/entropy.cpp
+
+#include "host.h"
+#include "entropy.h"
+
+static uint32_t xorshift(uint32_t x) {
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+//Undo x ^= x << s (or >> s)
+static uint32_t unshift_left(uint32_t y, unsigned char s) {
+	uint32_t x = y;
+	for(unsigned char i = 0; i < 32; i += s) x = y ^ (x << s);
+	return x;
+}
+
+static uint32_t unshift_right(uint32_t y, unsigned char s) {
+	uint32_t x = y;
+	for(unsigned char i = 0; i < 32; i += s) x = y ^ (x >> s);
+	return x;
+}
+
+static uint32_t unxorshift(uint32_t x) {
+	return unshift_left(unshift_right(unshift_left(x, 5), 17), 13);
+}
+
+//Biased raw bits, standing in for sensor LSBs: 1 with probability percent/100
+static uint32_t lcg = 1;
+static unsigned char biased_bit(unsigned char percent) {
+	lcg = lcg * 1103515245UL + 12345;
+	return ((lcg >> 16) % 100) < percent;
+}
+
+/*
+ * Feed raw bits one pair at a time and collect each pool as it is mixed in. The state is held
+ * at a known value between pairs, so the pool is recovered from the next output.
+ */
+static unsigned long pool_ones = 0, pool_bits = 0;
+static unsigned int pools = 0;
+static void collect_pools(unsigned char percent, unsigned long pairs) {
+	const uint32_t known = 0x12345678UL;
+	random_seed(known);
+	for(unsigned long i = 0; i < pairs; i++) {
+		entropy_add_bit(biased_bit(percent));
+		entropy_add_bit(biased_bit(percent));
+		uint32_t out = random32();
+		if(out != xorshift(known)) {
+			uint32_t pool = unxorshift(out) ^ known;
+			for(unsigned char b = 0; b < 32; b++) pool_ones += (pool >> b) & 1;
+			pool_bits += 32;
+			pools++;
+		}
+		random_seed(known);
+	}
+}
+
+//As random8() but reducing only 8 random bits
+static unsigned char random8_short(unsigned char lo, unsigned char hi) {
+	unsigned char r = random32() >> 24;
+	return lo + (((unsigned int) r * (unsigned char)(hi - lo)) >> 8);
+}
+
+int main() {
+	CHECK(unxorshift(xorshift(0xDEADBEEFUL)) == 0xDEADBEEFUL);
+
+	//Equal pairs carry no entropy and never reach the pool
+	random_seed(0x12345678UL);
+	for(unsigned char i = 0; i < 200; i++) {
+		entropy_add_bit(i & 2);
+		entropy_add_bit(i & 2);
+	}
+	entropy_flush();
+	CHECK(random32() == xorshift(0x12345678UL));
+
+	//Raw bits which are 80% ones come out of the filter balanced
+	collect_pools(80, 200000);
+	CHECK(pools > 500);
+	CHECK(fabs((double) pool_ones / pool_bits - 0.5) < 0.01);
+
+	/*
+	 * random8(0, 17) over 1.7M draws, about 100000 per bucket. Chance alone moves a bucket by
+	 * about 0.3%, so judge the spread with a chi-squared test: 16 degrees of freedom, and 32 is
+	 * exceeded by a uniform source only 1% of the time.
+	 */
+	const unsigned long draws = 1700000;
+	unsigned long buckets[17] = {0};
+	unsigned long short_buckets[17] = {0};
+	boolean in_range = true;
+	random_seed(1);
+	for(unsigned long i = 0; i < draws; i++) {
+		unsigned char r = random8(0, 17);
+		if(r >= 17) {
+			in_range = false;
+			break;
+		}
+		buckets[r]++;
+	}
+	for(unsigned long i = 0; i < draws; i++) short_buckets[random8_short(0, 17)]++;
+	CHECK(in_range);
+	double chi = 0, worst = 0, worst_short = 0;
+	for(unsigned char i = 0; i < 17; i++) {
+		double expected = draws / 17.0;
+		chi += (buckets[i] - expected) * (buckets[i] - expected) / expected;
+		worst = max(worst, fabs(buckets[i] / expected - 1));
+		worst_short = max(worst_short, fabs(short_buckets[i] / expected - 1));
+	}
+	CHECK(chi < 32);
+	CHECK(worst < 0.012);
+	//Which is why random8() takes 16 bits: with 8, one outcome in 17 is favoured by 6%
+	CHECK(worst_short > 0.05);
+
+	//Ranges are respected at both ends and every value is reachable
+	boolean seen_lo = false, seen_hi = false;
+	for(unsigned long i = 0; i < 100000; i++) {
+		unsigned int r = random16(100, 60000);
+		in_range &= r >= 100 && r < 60000;
+		seen_lo |= r < 200;
+		seen_hi |= r >= 59900;
+		in_range &= random8(5, 6) == 5;
+		in_range &= random8(0, 255) < 255;
+	}
+	CHECK(in_range);
+	CHECK(seen_lo && seen_hi);
+
+	return host_done();
+}
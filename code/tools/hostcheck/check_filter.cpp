@@ -0,0 +1,160 @@
+/*
+ * Orientation filter (compass.cpp): the filtered heading converges on the true heading and
+ * rides out noise, and confidence rises while the cube is still and drops while it is handled.
+ * Also times an update, and estimates its cost on the ATmega328 against the animation tick.
+ */
+//Sources: src/compass.cpp
+//Flags: -Wl,--wrap=atan2 -Wl,--wrap=atan2f
+
+#include "host.h"
+#include "options.h"
+#include "compass.h"
+#include "config.h"
+#include <time.h>
+
+ConfigRecord config;
+
+boolean HMC5883L::ReadScaledAxis(MagnetometerScaled *scaled) {
+	return false;
+}
+
+//atan2() is the most expensive call an update makes, so count them (the host's C++ library
+//calls the float version for float arguments, where avr-libc has only the one)
+static unsigned long atan2_calls = 0;
+
+extern "C" double __real_atan2(double y, double x);
+
+extern "C" double __wrap_atan2(double y, double x) {
+	atan2_calls++;
+	return __real_atan2(y, x);
+}
+
+extern "C" float __real_atan2f(float y, float x);
+
+extern "C" float __wrap_atan2f(float y, float x) {
+	atan2_calls++;
+	return __real_atan2f(y, x);
+}
+
+/*
+ * The cost of an update on the part, from its operations. Host timing does not carry over, and
+ * nearly all the work is in avr-libc's software floating point, so each kind of operation is
+ * given a pessimistic cycle count. The float operations of one update, read from compass.cpp:
+ *   updateOrientation(): 6 multiplies or conversions in, 6 conversions and 6 divides out
+ *   determineFace(): 3 abs() and up to 5 compares
+ *   getHeading(): 3 x (2 conversions, subtract, multiply, divide) for the calibration, atan2(),
+ *     up to 4 adds or compares normalising, 2 multiply or divide to degrees and a round()
+ * and 3 long multiplies for the magnitude. Adds, multiplies, compares and conversions are
+ * counted as one kind, as are divides.
+ */
+#define AVR_CYCLES_PER_US (F_CPU / 1000000)
+#define AVR_FLOAT_OP_CYCLES 200
+#define AVR_FLOAT_DIV_CYCLES 600
+#define AVR_ATAN2_CYCLES 4000
+#define AVR_LONG_MUL_CYCLES 80
+#define UPDATE_FLOAT_OPS (6 + 6 + 3 + 5 + 3 * 4 + 4 + 1 + 1)
+#define UPDATE_FLOAT_DIVS (6 + 3 + 1)
+#define UPDATE_LONG_MULS 3
+
+//A snapshot of a cube sitting level with face 4 up, the nose pointing at deg, in a field of 300 units
+static void snapshot(float deg, float g, MagnetometerScaled *mag, AccelerometerScaled *acc) {
+	acc->XAxis = 0;
+	acc->YAxis = 0;
+	acc->ZAxis = g;
+	mag->XAxis = 300 * cos(deg * PI / 180);
+	mag->YAxis = 300 * sin(deg * PI / 180);
+	mag->ZAxis = -200;
+}
+
+//The heading an unfiltered reading of the snapshot gives
+static int raw_heading(float deg) {
+	MagnetometerScaled mag;
+	AccelerometerScaled acc;
+	snapshot(deg, 1.0, &mag, &acc);
+	return getHeading(mag, acc);
+}
+
+static int bearing_error(int a, int b) {
+	int e = abs(a - b) % 360;
+	return e > 180 ? 360 - e : e;
+}
+
+int main() {
+	MagnetometerScaled mag;
+	AccelerometerScaled acc;
+	int heading = 0;
+
+	memset(&config, 0, sizeof(config));
+	for(unsigned char i = 3; i < 6; i++) config.mag_calibration[i] = MAG_SCALE_ONE;
+	setNose(1);
+
+	//A still cube: the first snapshot is taken as-is and confidence builds up
+	resetOrientation();
+	CHECK(getHeadingConfidence() == 0);
+	snapshot(60, 1.0, &mag, &acc);
+	heading = updateOrientation(mag, acc);
+	CHECK(heading == raw_heading(60));
+	for(unsigned char i = 0; i < 20; i++) heading = updateOrientation(mag, acc);
+	CHECK(heading == raw_heading(60));
+	CHECK(getHeadingConfidence() >= ORIENT_CONFIDENT);
+
+	//Turned by 90 degrees: within 1 degree after 20 snapshots
+	snapshot(150, 1.0, &mag, &acc);
+	for(unsigned char i = 0; i < 20; i++) heading = updateOrientation(mag, acc);
+	CHECK(bearing_error(heading, raw_heading(150)) <= 1);
+
+	//Noise within the tolerances: the filtered heading wanders less than the raw readings
+	int worst_raw = 0, worst_filtered = 0;
+	for(unsigned char i = 0; i < 40; i++) {
+		MagnetometerScaled noisy;
+		snapshot(150, 1.0, &noisy, &acc);
+		noisy.XAxis += (i & 1) ? 40 : -40;
+		noisy.YAxis += (i & 2) ? 40 : -40;
+		worst_raw = max(worst_raw, bearing_error(getHeading(noisy, acc), raw_heading(150)));
+		heading = updateOrientation(noisy, acc);
+		worst_filtered = max(worst_filtered, bearing_error(heading, raw_heading(150)));
+	}
+	CHECK(worst_raw >= 8);
+	CHECK(worst_filtered < worst_raw / 2);
+	CHECK(getHeadingConfidence() >= ORIENT_CONFIDENT);
+
+	//Being shaken: the accelerometer reads well away from 1G and confidence drops within a few snapshots
+	for(unsigned char i = 0; i < 4; i++) {
+		snapshot(150, (i & 1) ? 1.6 : 0.4, &mag, &acc);
+		updateOrientation(mag, acc);
+	}
+	CHECK(getHeadingConfidence() < ORIENT_CONFIDENT);
+	CHECK(!pointingCorrectly(180, ORIENT_CONFIDENT));
+	CHECK(pointingCorrectly(180));
+
+	//Back at rest it recovers
+	snapshot(150, 1.0, &mag, &acc);
+	for(unsigned char i = 0; i < 20; i++) heading = updateOrientation(mag, acc);
+	CHECK(getHeadingConfidence() >= ORIENT_CONFIDENT);
+	CHECK(bearing_error(heading, raw_heading(150)) <= 1);
+
+	//After a reset the next snapshot is taken as-is
+	resetOrientation();
+	snapshot(300, 1.0, &mag, &acc);
+	CHECK(updateOrientation(mag, acc) == raw_heading(300));
+
+	//Cost. One atan2() an update (getHeading() takes just one), and well within a tick on the part,
+	//as play_animation() updates once every SENSE_MS in the same loop as the ticks.
+	const unsigned long updates = 100000;
+	atan2_calls = 0;
+	clock_t start = clock();
+	for(unsigned long i = 0; i < updates; i++) {
+		snapshot(i % 360, 1.0, &mag, &acc);
+		heading = updateOrientation(mag, acc);
+	}
+	double host_ns = (clock() - start) * 1e9 / CLOCKS_PER_SEC / updates;
+	CHECK(atan2_calls == updates);
+	unsigned long avr_cycles = UPDATE_FLOAT_OPS * AVR_FLOAT_OP_CYCLES + UPDATE_FLOAT_DIVS * AVR_FLOAT_DIV_CYCLES
+			+ (atan2_calls / updates) * AVR_ATAN2_CYCLES + UPDATE_LONG_MULS * AVR_LONG_MUL_CYCLES;
+	unsigned long avr_us = avr_cycles / AVR_CYCLES_PER_US;
+	CHECK(avr_us < TICK_MS * 1000UL / 10);
+	fprintf(stderr, "update %.0f ns on the host, at most %lu cycles (%lu us) on the part, %.1f%% of a %u ms tick\n",
+			host_ns, avr_cycles, avr_us, avr_us * 100.0 / (TICK_MS * 1000UL), TICK_MS);
+
+	return host_done();
+}
@@ -0,0 +1,152 @@
+/*
+ * LED colours (leds.cpp): white balanced native colours are rounded to the nearest native
+ * level, so they cost the scanner interrupt nothing at the end of a cycle. 8 bit colours which
+ * land exactly on native levels are left undithered at those levels, and anything between them
+ * is dithered. getLED() gives back the colour asked for rather than the scaled or dithered
+ * one, and a fading LED is dithered once a PWM cycle like any other, whatever is set meanwhile.
+ * Also counts the work of a pulse of Pulse, stepped by fades against the old per tick sets.
+ */
+//Sources: src/leds.cpp src/config.cpp src/peripherals.cpp lib/TimerOne.cpp arduinolib/EEPROM.cpp
+
+#include "host.h"
+#include "options.h"
+#include "ledscanner.h"
+#include "leds.h"
+#include "config.h"
+
+//The same scanner as leds.cpp, so the same frame buffer
+typedef LedScanner<LED_ANODES, LED_CATHODES, LED_SCANMAX, LED_SCANNER_RATE_US, LED_GROUP_MAX> Scanner;
+
+//Red level of LED 0 over time, from the Timer1 interrupt: the frame buffer only changes in it
+static unsigned long long level_us = 0;
+static unsigned long level_since = 0;
+
+static void integrate() {
+	level_us += (unsigned long long) Scanner::buffer[0].r * (host_us - level_since);
+	level_since = host_us;
+}
+
+static boolean is(Colour c, unsigned char r, unsigned char g, unsigned char b) {
+	return c.r == r && c.g == g && c.b == b;
+}
+
+int main() {
+	load_config();
+
+	//Unscaled LEDs go straight into the frame buffer
+	setLED(0, 4, 2, 6);
+	CHECK(!Scanner::is_dithered());
+	CHECK(is(Scanner::buffer[0], 4, 2, 6));
+
+	//Half scale on every channel: even levels halve exactly
+	for(unsigned char ch = 0; ch < 3; ch++) config.led_scale[0][ch] = LED_SCALE_ONE / 2;
+	setLED(0, 4, 2, 6);
+	CHECK(!Scanner::is_dithered());
+	CHECK(is(Scanner::buffer[0], 2, 1, 3));
+	CHECK(is(getLED(0), 4, 2, 6));
+
+	//An odd level falls between two, as does full brightness, and each is rounded to the nearest
+	setLED(0, 3, 2, 6);
+	CHECK(!Scanner::is_dithered());
+	CHECK(is(Scanner::buffer[0], 2, 1, 3));
+	CHECK(is(getLED(0), 3, 2, 6));
+	setLED(0, LED_SCANMAX, 0, 0);
+	CHECK(!Scanner::is_dithered());
+	CHECK(is(Scanner::buffer[0], LED_SCANMAX / 2, 0, 0));
+
+	//Black is black whatever the scale
+	setLED(0, 0, 0, 0);
+	CHECK(!Scanner::is_dithered());
+
+	//Every LED scaled, so every level between two, costs no end of cycle work in the interrupt.
+	//An 8 bit colour between levels on one of them does.
+	host_poll_us = 4;
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		for(unsigned char ch = 0; ch < 3; ch++) config.led_scale[i][ch] = LED_SCALE_ONE / 2 + 10 * i;
+		setLED(i, 3, 5, LED_SCANMAX - i);
+	}
+	start_led_scanner();
+	host_advance_ms(100);
+	unsigned int all_scaled_us = led_cycle_us();
+	CHECK(all_scaled_us == 0);
+	setLED8(0, 128, 0, 0);
+	host_advance_ms(100);
+	unsigned int dithered_us = led_cycle_us();
+	CHECK(dithered_us > 0);
+	stop_led_scanner();
+	host_poll_us = 0;
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		for(unsigned char ch = 0; ch < 3; ch++) config.led_scale[i][ch] = LED_SCALE_ONE;
+		setLED(i, 0, 0, 0);
+	}
+	CHECK(!Scanner::is_dithered());
+
+	//8 bit colours on unscaled LEDs, once gamma corrected
+	setLED8(1, 255, 0, 255);
+	CHECK(!Scanner::is_dithered());
+	CHECK(is(Scanner::buffer[1], LED_SCANMAX, 0, LED_SCANMAX));
+	setLED8(1, 128, 0, 0); //56 of 256 once gamma corrected, 1.75 levels
+	CHECK(Scanner::is_dithered());
+	CHECK(is(getLED(1), (56 * LED_SCANMAX + 128) / 256, 0, 0));
+
+	//A fade which holds a colour half way between two levels (16 of 256 once gamma corrected)
+	//is stepped at the end of every PWM cycle, and shows the half level on average
+	for(unsigned char ch = 0; ch < 3; ch++) config.led_scale[0][ch] = LED_SCALE_ONE;
+	for(unsigned char i = 0; i < NUMLEDS; i++) setLED(i, 0, 0, 0);
+	host_timer1_hook = integrate;
+	start_led_scanner();
+	setLED8(0, 72, 0, 0);
+	fadeLED8(0, 72, 0, 0, 2000);
+	host_advance_ms(10);
+	level_us = 0;
+	level_since = host_us;
+	host_advance_ms(1000);
+	CHECK(leds_fading());
+	double level = level_us / 1e6;
+	CHECK(fabs(level - 16.0 * LED_SCANMAX / 256) < 0.05);
+	host_timer1_hook = NULL;
+
+	//Setting one LED while the interrupt fades another leaves the fade alone, and each LED ends
+	//where it was sent. Interrupts are back on after each set.
+	setLED(0, 0, 0, 0);
+	setLED8(1, 0, 0, 0);
+	fadeLED8(1, 0, 255, 0, 500);
+	boolean rising = true, exact = true;
+	unsigned char green = 0;
+	unsigned long start = host_us;
+	for(unsigned int i = 0; leds_fading() && host_us - start < 1000000UL; i++) {
+		unsigned char v = i % (LED_SCANMAX + 1);
+		setLED(0, v, v, 0);
+		exact &= is(Scanner::buffer[0], v, v, 0) && (SREG & _BV(SREG_I));
+		rising &= getLED(1).g >= green;
+		green = getLED(1).g;
+		host_advance_us(997);
+	}
+	CHECK(exact);
+	CHECK(rising);
+	CHECK(host_us - start >= 490000UL && host_us - start <= 510000UL);
+	CHECK(is(Scanner::buffer[1], 0, LED_SCANMAX, 0));
+	CHECK(is(getLED(1), 0, LED_SCANMAX, 0));
+	CHECK(!Scanner::is_dithered());
+
+	//The work of one pulse of Pulse. It used to set every LED each tick, LED_SCANMAX ticks a
+	//pulse. Now the interrupt steps every fading LED each PWM cycle of the fade.
+	const unsigned long cycle = (unsigned long) LED_SCANNER_RATE_US * NUMLEDS * LED_SCANMAX;
+	const unsigned int tick_sets = NUMLEDS * LED_SCANMAX;
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		setLED(i, 0, 0, 0);
+		fadeLED8(i, 255, 0, 0, LED_SCANMAX * TICK_MS);
+	}
+	start = host_us;
+	while(leds_fading()) host_advance_us(LED_SCANNER_RATE_US);
+	unsigned int fade_cycles = (host_us - start + cycle / 2) / cycle;
+	unsigned int fade_steps = fade_cycles * NUMLEDS;
+	CHECK(fade_cycles == (LED_SCANMAX * TICK_MS * 1000UL + cycle / 2) / cycle);
+	stop_led_scanner();
+	fprintf(stderr, "a pulse: %u LED sets over %u ticks before, %u LED steps over %u PWM cycles (%u a cycle) now\n",
+			tick_sets, LED_SCANMAX, fade_steps, fade_cycles, NUMLEDS);
+	fprintf(stderr, "held fade averages %.3f levels, end of cycle work %u us with every LED scaled, %u us with one dithered\n",
+			level, all_scaled_us, dithered_us);
+
+	return host_done();
+}
@@ -0,0 +1,95 @@
+/*
+ * Magnetometer calibration (fit_mag_calibration() in compass.cpp): from the axis extremes of a
+ * synthetic distorted field it recovers the hard iron offsets and soft iron scales, and
+ * getHeading() with the result matches the undistorted heading.
+ */
+//Sources: src/compass.cpp
+
+#include "host.h"
+#include "compass.h"
+#include "config.h"
+
+ConfigRecord config;
+
+boolean HMC5883L::ReadScaledAxis(MagnetometerScaled *scaled) {
+	return false;
+}
+
+static const float offset[3] = {120, -80, 45};
+static const float scale[3] = {1.2, 0.8, 1.0};
+
+//The undistorted field of 400 units with the nose at deg and the cube tilted by tilt degrees
+static MagnetometerScaled field(float deg, float tilt) {
+	MagnetometerScaled m;
+	m.XAxis = 400 * cos(tilt * PI / 180) * cos(deg * PI / 180);
+	m.YAxis = 400 * cos(tilt * PI / 180) * sin(deg * PI / 180);
+	m.ZAxis = 400 * sin(tilt * PI / 180);
+	return m;
+}
+
+//What the sensor reads next to the motor, battery and speaker
+static MagnetometerScaled distort(MagnetometerScaled m) {
+	m.XAxis = m.XAxis * scale[0] + offset[0];
+	m.YAxis = m.YAxis * scale[1] + offset[1];
+	m.ZAxis = m.ZAxis * scale[2] + offset[2];
+	return m;
+}
+
+static int bearing_error(int a, int b) {
+	int e = abs(a - b) % 360;
+	return e > 180 ? 360 - e : e;
+}
+
+int main() {
+	int mins[3] = {32767, 32767, 32767};
+	int maxs[3] = {-32768, -32768, -32768};
+	int16_t cal[6];
+	AccelerometerScaled level = {0, 0, 1.0};
+
+	//Turn the cube through every orientation, as calibrate_magnetometer() asks
+	for(int tilt = -90; tilt <= 90; tilt += 15) {
+		for(int deg = 0; deg < 360; deg += 15) {
+			MagnetometerScaled m = distort(field(deg, tilt));
+			int v[3] = {(int) round(m.XAxis), (int) round(m.YAxis), (int) round(m.ZAxis)};
+			for(unsigned char i = 0; i < 3; i++) {
+				mins[i] = min(mins[i], v[i]);
+				maxs[i] = max(maxs[i], v[i]);
+			}
+		}
+	}
+
+	fit_mag_calibration(mins, maxs, cal);
+	for(unsigned char i = 0; i < 3; i++) {
+		CHECK(cal[i] == offset[i]);
+		//The mean radius is 400, so each axis is scaled by 1/scale
+		CHECK(abs(cal[3 + i] - MAG_SCALE_ONE / scale[i]) <= 2);
+	}
+
+	//Headings through the fitted correction match the undistorted field
+	memcpy(config.mag_calibration, cal, sizeof(cal));
+	setNose(1);
+	int worst_corrected = 0, worst_raw = 0;
+	for(int deg = 0; deg < 360; deg += 5) {
+		int corrected = getHeading(distort(field(deg, 0)), level);
+
+		int16_t identity[6] = {0, 0, 0, MAG_SCALE_ONE, MAG_SCALE_ONE, MAG_SCALE_ONE};
+		memcpy(config.mag_calibration, identity, sizeof(identity));
+		int truth = getHeading(field(deg, 0), level);
+		int raw = getHeading(distort(field(deg, 0)), level);
+		memcpy(config.mag_calibration, cal, sizeof(cal));
+
+		worst_corrected = max(worst_corrected, bearing_error(corrected, truth));
+		worst_raw = max(worst_raw, bearing_error(raw, truth));
+	}
+	CHECK(worst_corrected <= 1);
+	CHECK(worst_raw > 10);
+
+	//An axis which never moved is left unscaled
+	int flat_mins[3] = {-400, -400, 50};
+	int flat_maxs[3] = {400, 400, 50};
+	fit_mag_calibration(flat_mins, flat_maxs, cal);
+	CHECK(cal[2] == 50);
+	CHECK(cal[5] == MAG_SCALE_ONE);
+
+	return host_done();
+}
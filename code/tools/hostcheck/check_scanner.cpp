@@ -0,0 +1,234 @@
+/*
+ * LED scanner (ledscanner.h) on the cube's wiring, with pins which are watched on every change:
+ * each channel is lit for value / Levels of its LED's slots (value / period when the period is
+ * stretched, and the linear level on average when dithered), no more than LED_GROUP_MAX LEDs
+ * are ever lit at once, and no LED is ever driven backwards. Also counts the interrupts each PWM
+ * cycle takes for the animations' usual frames at groups of one, two and three LEDs.
+ */
+//Sources:
+
+#include "host.h"
+#include "ledscanner.h"
+
+//A MockPin which checks the wiring each time it changes
+static void watch();
+
+template<unsigned char Pin> struct WatchedPin : MockPin<Pin> {
+	static void high() { MockPin<Pin>::high(); watch(); }
+	static void low() { MockPin<Pin>::low(); watch(); }
+	static void output() { MockPin<Pin>::output(); watch(); }
+	static void input() { MockPin<Pin>::input(); watch(); }
+};
+
+#define LED_PIN WatchedPin
+#include "options.h"
+
+typedef LedScanner<LED_ANODES, LED_CATHODES, LED_SCANMAX, LED_SCANNER_RATE_US, LED_GROUP_MAX> Scanner;
+typedef LED_CATHODES Cathodes;
+
+template<class Pin> static bool sourcing() {
+	return Pin::driven && Pin::level;
+}
+
+template<class Pin> static bool sinking() {
+	return Pin::driven && !Pin::level;
+}
+
+//Anodes driven high, LED 0 bit 0, and anodes driven low
+static void anodes(const PinListEnd &, unsigned char, unsigned char &, unsigned char &) {
+}
+
+template<class Pin, class Next> static void anodes(const PinList<Pin, Next> &, unsigned char bit, unsigned char &high, unsigned char &low) {
+	if(sourcing<Pin>()) high |= bit;
+	if(sinking<Pin>()) low |= bit;
+	anodes(Next(), bit << 1, high, low);
+}
+
+static unsigned char lit_mask() {
+	unsigned char high = 0, low = 0;
+	anodes(LED_ANODES(), 1, high, low);
+	return high;
+}
+
+static unsigned char most_lit = 0;
+static bool backwards = false;
+
+static void watch() {
+	unsigned char high = 0, low = 0;
+	unsigned char lit = 0;
+
+	anodes(LED_ANODES(), 1, high, low);
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		if(high & (1 << i)) lit++;
+	}
+	if(sinking<Cathodes::Red>() || sinking<Cathodes::Green>() || sinking<Cathodes::Blue>()) most_lit = max(most_lit, lit);
+
+	//A cathode above an anode
+	if(low != 0 && (sourcing<Cathodes::Red>() || sourcing<Cathodes::Green>() || sourcing<Cathodes::Blue>())) backwards = true;
+}
+
+//Slots each channel of each LED was lit for, over whole PWM cycles as the interrupt runs them
+static unsigned long on[NUMLEDS][3];
+static unsigned long slots_run;
+
+static void run_cycles(unsigned int cycles) {
+	memset(on, 0, sizeof(on));
+	slots_run = 0;
+	while(cycles > 0) {
+		bool cycle_end;
+		unsigned char slots = Scanner::subscan(cycle_end);
+		unsigned char lit = lit_mask();
+		bool cathode[3] = {sinking<Cathodes::Red>(), sinking<Cathodes::Green>(), sinking<Cathodes::Blue>()};
+
+		for(unsigned char i = 0; i < NUMLEDS; i++) {
+			for(unsigned char ch = 0; ch < 3; ch++) {
+				if((lit & (1 << i)) && cathode[ch]) on[i][ch] += slots;
+			}
+		}
+		slots_run += slots;
+		if(cycle_end) {
+			if(Scanner::is_dithered()) Scanner::dither();
+			cycles--;
+		}
+	}
+}
+
+static double duty(unsigned char led, unsigned char ch) {
+	return on[led][ch] * (double) NUMLEDS / slots_run;
+}
+
+//A frame in native levels, or dithered 8 bit linear levels
+typedef struct {
+	const char *name;
+	bool linear;
+	Colour colour[NUMLEDS];
+} Frame;
+
+#define W LED_SCANMAX
+static const Frame frames[] = {
+	{"clearLEDs", false, {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}}},
+	{"one face white", false, {{W, W, W}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}}},
+	//Half way through the red fade, and an orange of the wash with the nose dark
+	{"Pulse", true, {{128, 0, 0}, {128, 0, 0}, {128, 0, 0}, {128, 0, 0}, {128, 0, 0}, {128, 0, 0}}},
+	{"Unhappy wash", true, {{255, 96, 0}, {255, 96, 0}, {255, 96, 0}, {255, 96, 0}, {255, 96, 0}, {0, 0, 0}}},
+	{"all white", false, {{W, W, W}, {W, W, W}, {W, W, W}, {W, W, W}, {W, W, W}, {W, W, W}}},
+};
+#undef W
+#define NUM_FRAMES (sizeof(frames) / sizeof(frames[0]))
+
+//Calls to subscan(), so interrupts, per PWM cycle on average
+template<class S> static double interrupts_per_cycle(const Frame &frame) {
+	const unsigned int cycles = 64;
+	unsigned long calls = 0;
+	unsigned int done = 0;
+
+	S::initialise();
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		if(frame.linear) S::set_linear(i, frame.colour[i]);
+		else S::set_native(i, frame.colour[i]);
+	}
+	while(done < cycles) {
+		bool cycle_end;
+		S::subscan(cycle_end);
+		calls++;
+		if(cycle_end) {
+			if(S::is_dithered()) S::dither();
+			done++;
+		}
+	}
+	S::release();
+	return (double) calls / cycles;
+}
+
+typedef LedScanner<LED_ANODES, LED_CATHODES, LED_SCANMAX, LED_SCANNER_RATE_US, 1> Group1;
+typedef LedScanner<LED_ANODES, LED_CATHODES, LED_SCANMAX, LED_SCANNER_RATE_US, 2> Group2;
+typedef LedScanner<LED_ANODES, LED_CATHODES, LED_SCANMAX, LED_SCANNER_RATE_US, 3> Group3;
+
+static void check_native(unsigned char period) {
+	bool exact = true;
+
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		for(unsigned char ch = 0; ch < 3; ch++) {
+			unsigned char value = ((unsigned char *) &Scanner::buffer[i])[ch];
+			exact &= on[i][ch] * NUMLEDS * period == (unsigned long) min(value, period) * slots_run;
+		}
+	}
+	CHECK(exact);
+}
+
+int main() {
+	Colour c;
+
+	Scanner::initialise();
+	CHECK(!backwards);
+
+	//Every native level on every channel, with each LED different
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		c.r = i % (LED_SCANMAX + 1);
+		c.g = (i + 3) % (LED_SCANMAX + 1);
+		c.b = LED_SCANMAX - i;
+		Scanner::set_native(i, c);
+	}
+	run_cycles(3);
+	check_native(LED_SCANMAX);
+
+	//All the same colour, which would light every LED at once if groups were not bounded
+	c.r = LED_SCANMAX;
+	c.g = LED_SCANMAX / 2;
+	c.b = 1;
+	for(unsigned char i = 0; i < NUMLEDS; i++) Scanner::set_native(i, c);
+	run_cycles(3);
+	check_native(LED_SCANMAX);
+
+	//A longer period dims every LED in proportion, and full brightness is lit for Levels of it
+	Scanner::period = LED_SCANMAX * 2;
+	run_cycles(3);
+	check_native(LED_SCANMAX * 2);
+	Scanner::period = LED_SCANMAX;
+
+	//Dithered levels average out to the linear level, within a level over the cycles run
+	const unsigned int cycles = 256;
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		c.r = 37 * i + 5;
+		c.g = 255 - 29 * i;
+		c.b = 128 + i;
+		Scanner::set_linear(i, c);
+	}
+	run_cycles(cycles);
+	double worst = 0;
+	for(unsigned char i = 0; i < NUMLEDS; i++) {
+		Colour t = Scanner::get_linear(i);
+		unsigned char linear[3] = {t.r, t.g, t.b};
+		for(unsigned char ch = 0; ch < 3; ch++) {
+			double expected = linear[ch] == 255 ? 1 : linear[ch] / 256.0;
+			worst = max(worst, fabs(duty(i, ch) - expected));
+		}
+	}
+	CHECK(worst <= 1.0 / (LED_SCANMAX * cycles));
+
+	//Turned off, nothing is lit
+	Scanner::release();
+	CHECK(lit_mask() == 0);
+
+	CHECK(most_lit > 0 && most_lit <= LED_GROUP_MAX);
+	CHECK(!backwards);
+	fprintf(stderr, "at most %u LEDs lit at once, worst dithered duty error %.5f\n", most_lit, worst);
+
+	//Interrupts per cycle: one per level while dark, one more per LED lit alone, and fewer as
+	//LEDs of the same colour share a slot
+	fprintf(stderr, "interrupts per PWM cycle, groups of 1, 2 and 3:\n");
+	for(unsigned char f = 0; f < NUM_FRAMES; f++) {
+		double n[3] = {interrupts_per_cycle<Group1>(frames[f]), interrupts_per_cycle<Group2>(frames[f]), interrupts_per_cycle<Group3>(frames[f])};
+
+		CHECK(n[0] >= n[1] && n[1] >= n[2]);
+		CHECK(n[2] >= LED_SCANMAX && n[0] <= NUMLEDS * LED_SCANMAX);
+		fprintf(stderr, "  %-16s %5.1f %5.1f %5.1f\n", frames[f].name, n[0], n[1], n[2]);
+	}
+	CHECK(interrupts_per_cycle<Group3>(frames[0]) == LED_SCANMAX);
+	CHECK(interrupts_per_cycle<Group1>(frames[1]) == 2 * LED_SCANMAX);
+	CHECK(interrupts_per_cycle<Group1>(frames[4]) == NUMLEDS * LED_SCANMAX);
+	CHECK(interrupts_per_cycle<Group2>(frames[4]) == (NUMLEDS / 2 + 1) * LED_SCANMAX);
+	CHECK(!backwards);
+
+	return host_done();
+}
@@ -0,0 +1,106 @@
+/*
+ * Command shell (shell.cpp): a host is only seen when it drives the RX line high, not when the
+ * line floats at whatever level it was left at, commands change and save the configuration,
+ * and telemetry sent with the serial line closed returns rather than waiting for it to drain.
+ */
+//Sources: src/shell.cpp src/animations.cpp src/behaviour.cpp src/battery.cpp src/capture.cpp src/compass.cpp src/config.cpp src/entropy.cpp src/eventlog.cpp src/leds.cpp src/peripherals.cpp src/RTTTL.cpp src/telemetry.cpp src/timekeeping.cpp src/tokenlog.cpp src/utils.cpp lib/ADXL345.cpp lib/HMC5883L.cpp lib/TimerOne.cpp arduinolib/EEPROM.cpp tools/hostcheck/host/board.cpp
+
+#include "host.h"
+#include "options.h"
+#include "shell.h"
+#include "config.h"
+#include "peripherals.h"
+#include "telemetry.h"
+#include "eventlog.h"
+#include "ADXL345.h"
+#include "HMC5883L.h"
+
+ADXL345 accel(ADXL345_ADDRESS);
+HMC5883L compass;
+
+static char out[4096];
+
+static void command(const char *line) {
+	memset(out, 0, sizeof(out));
+	host_serial_out = fmemopen(out, sizeof(out) - 1, "w");
+	host_serial_input(line);
+	shell_poll();
+	fclose(host_serial_out);
+	host_serial_out = NULL;
+}
+
+int main() {
+	load_config();
+
+	//Nothing attached. The pin reads high until it has been driven, which the check must not trust.
+	host_pin_external[SHELL_RX_PIN] = HOST_FLOATING;
+	CHECK(digitalRead(SHELL_RX_PIN) == HIGH);
+	CHECK(!shell_host_attached());
+	CHECK(!shell_host_attached());
+
+	//A host holding the line high, or low
+	host_pin_external[SHELL_RX_PIN] = HIGH;
+	CHECK(shell_host_attached());
+	host_pin_external[SHELL_RX_PIN] = LOW;
+	CHECK(!shell_host_attached());
+
+	//It takes little time
+	host_pin_external[SHELL_RX_PIN] = HIGH;
+	unsigned long start = micros();
+	shell_host_attached();
+	CHECK(micros() - start < 1000);
+
+	//Commands
+	serial_on();
+	command("set nose_anims_min 5\r\n");
+	CHECK(config.nose_anims_min == 5);
+	CHECK(strstr(out, "ok") != NULL);
+	command("get anim_gap_max\r\n");
+	CHECK(strstr(out, "anim_gap_max 1800\r\n") != NULL);
+	command("set nose 9\r\n");
+	CHECK(strstr(out, "error") != NULL);
+	command("set nose x\r\n");
+	CHECK(strstr(out, "error") != NULL);
+	command("set bearing 359\r\n");
+	CHECK(config.bearing == 359);
+	command("set bearing 360\r\n");
+	CHECK(strstr(out, "error") != NULL && config.bearing == 359);
+	command("set anim_gap_max 12x\r\n");
+	CHECK(strstr(out, "error") != NULL && config.anim_gap_max == 1800);
+	command("scale 2 255 200 180\r\n");
+	CHECK(config.led_scale[2][1] == 200);
+	command("bogus\r\n");
+	CHECK(strstr(out, "error") != NULL);
+
+	//Saved, so the next boot has them
+	default_config(&config);
+	CHECK(load_config());
+	CHECK(config.nose_anims_min == 5 && config.led_scale[2][2] == 180);
+
+	//A line arriving counts as a host, even though a start bit holds the line low
+	host_pin_external[SHELL_RX_PIN] = LOW;
+	host_serial_input("get\r\n");
+	CHECK(shell_host_attached());
+	host_serial_input("");
+
+	//A host unplugged while the port is open leaves the line charged high, which the receiver
+	//does nothing about. It must still be seen to have gone, and the port closed.
+	host_pin_external[SHELL_RX_PIN] = HIGH;
+	CHECK(shell_host_attached());
+	CHECK(serial_is_on());
+	host_pin_external[SHELL_RX_PIN] = HOST_FLOATING;
+	CHECK(digitalRead(SHELL_RX_PIN) == HIGH);
+	CHECK(!shell_host_attached());
+	CHECK(!serial_is_on());
+	serial_on();
+
+	//Events wait for room in the transmit queue. With the port closed there is never any,
+	//so they must be dropped (time stands still here, so a wait would never end).
+	command("telemetry on\r\n");
+	CHECK(telemetry_on);
+	serial_off();
+	for(unsigned char i = 0; i < 50; i++) log_event(EVENT_NOSE_CHANGE, i);
+	CHECK(!telemetry_send(TELEMETRY_EVENT, "ab", 2, true));
+
+	return host_done();
+}
@@ -0,0 +1,51 @@
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Strings from F() are ordinary strings on the host
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *) (s))
+
+class Print {
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buffer, size_t size);
+
+	size_t print(const __FlashStringHelper *s);
+	size_t print(const char *s);
+	size_t print(char c);
+	size_t print(unsigned char n, int base = DEC_BASE);
+	size_t print(int n, int base = DEC_BASE);
+	size_t print(unsigned int n, int base = DEC_BASE);
+	size_t print(long n, int base = DEC_BASE);
+	size_t print(unsigned long n, int base = DEC_BASE);
+	size_t print(double n, int digits = 2);
+
+	size_t println(const __FlashStringHelper *s);
+	size_t println(const char *s);
+	size_t println(char c);
+	size_t println(unsigned char n, int base = DEC_BASE);
+	size_t println(int n, int base = DEC_BASE);
+	size_t println(unsigned int n, int base = DEC_BASE);
+	size_t println(long n, int base = DEC_BASE);
+	size_t println(unsigned long n, int base = DEC_BASE);
+	size_t println(double n, int digits = 2);
+	size_t println();
+
+private:
+	enum { DEC_BASE = 10 };
+	size_t print_number(unsigned long n, int base);
+};
+
+class Stream : public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+	virtual void flush() = 0;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include <avr/io.h>
+
+//The global interrupt flag is SREG bit 7, as on the AVR, so SREG save/cli/restore works
+#define sei() (SREG |= 0x80)
+#define cli() (SREG &= ~0x80)
+
+//Vectors become ordinary functions. host.cpp calls TIMER1_OVF_vect() as Timer1 overflows (see host.h).
+#define ISR(vector) void vector()
+#define SIGNAL(vector) void vector()
+
+#endif
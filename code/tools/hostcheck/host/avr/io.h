@@ -0,0 +1,75 @@
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+#include <stdint.h>
+
+//The ATmega328 registers the firmware touches, as plain variables (defined in host.cpp)
+extern volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+extern volatile uint8_t SREG, PRR, MCUSR, WDTCSR, ADMUX, ACSR, TWCR;
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1, GTCCR;
+extern volatile uint16_t ADC, ICR1, TCNT1, OCR1A, OCR1B;
+
+//Except ADCSRA: a conversion started with ADSC finishes at once, leaving its result in ADC
+struct HostAdcsra {
+	uint8_t value;
+	operator uint8_t() const { return value; }
+	HostAdcsra &operator=(uint8_t v);
+	HostAdcsra &operator|=(uint8_t v) { return *this = value | v; }
+	HostAdcsra &operator&=(uint8_t v) { return *this = value & v; }
+};
+extern HostAdcsra ADCSRA;
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_BYTE(sfr) (sfr)
+
+#define F_CPU 16000000UL
+#define E2END 0x3FF
+
+#define SREG_I 7
+
+#define WDIF 7
+#define WDIE 6
+#define WDP3 5
+#define WDCE 4
+#define WDE 3
+#define WDP2 2
+#define WDP1 1
+#define WDP0 0
+#define WDRF 3
+
+#define REFS1 7
+#define REFS0 6
+#define MUX3 3
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+
+#define ADEN 7
+#define ADSC 6
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+#define PRTWI 7
+#define PRTIM2 6
+#define PRTIM0 5
+#define PRTIM1 3
+#define PRSPI 2
+#define PRUSART0 1
+#define PRADC 0
+
+#define TWEN 2
+
+#define COM1A1 7
+#define COM1B1 5
+#define WGM13 4
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define TOIE1 0
+#define PSRSYNC 0
+
+#define PORTB2 2
+#define PORTB1 1
+
+#endif
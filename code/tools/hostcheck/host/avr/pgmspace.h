@@ -0,0 +1,25 @@
+#ifndef HOST_AVR_PGMSPACE_H
+#define HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+//There is only one address space on the host
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char *
+
+typedef char prog_char;
+typedef unsigned char prog_uchar;
+typedef uint16_t prog_uint16_t;
+
+#define pgm_read_byte(p) (*(const uint8_t *) (p))
+#define pgm_read_word(p) (*(const uint16_t *) (p))
+#define pgm_read_dword(p) (*(const uint32_t *) (p))
+
+#define strcmp_P strcmp
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+#endif
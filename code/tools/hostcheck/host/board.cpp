@@ -0,0 +1,186 @@
+#include "host.h"
+#include "options.h"
+#include "i2c_common.h"
+#include "ADXL345.h"
+#include "HMC5883L.h"
+#include "Narcoleptic.h"
+#include <Wire.h>
+
+/*
+ * The rest of the cube, for checks which build the whole firmware (see host.h).
+ *
+ * The sensor stick is modelled at the level of i2c_common.cpp, so the ADXL345 and HMC5883L
+ * drivers are built unchanged. Each part has a register file and only answers while
+ * PIN_SENSOR_POWER is driven high, coming back with its reset values after a power cut.
+ * Readings are host_accel and host_mag plus a little noise from a fixed sequence, so runs
+ * repeat exactly and the entropy pool still has low bits to gather.
+ *
+ * Narcoleptic sleeps stop the processor, so millis() and Timer1 stand still through them as on
+ * the part, but the sensors run on (the accelerometer FIFO fills while the processor sleeps).
+ */
+
+int host_accel[3] = {0, 0, 256};
+int host_mag[3] = {300, 0, -200};
+
+static unsigned long slept_us = 0;
+
+//Time as the sensors see it
+static unsigned long sensor_us() {
+	return host_us + slept_us;
+}
+
+static int noise() {
+	static unsigned long state = 12345;
+	state = state * 1103515245UL + 12345;
+	return (int) ((state >> 16) % 5) - 2;
+}
+
+//---------------------------------------------------------------------------------
+// ADXL345
+
+static uint8_t accel_reg[0x3A];
+static unsigned long fifo_start_us;
+static unsigned char fifo_popped;
+
+static void accel_reset() {
+	memset(accel_reg, 0, sizeof(accel_reg));
+	accel_reg[0x00] = 0xE5;
+	accel_reg[Register_BWRate] = ADXL345_RATE_100HZ;
+}
+
+static unsigned char fifo_entries() {
+	if((accel_reg[Register_FifoControl] & 0xC0) == ADXL345_FIFO_BYPASS) return 0;
+	unsigned long filled = (sensor_us() - fifo_start_us) / (ACCEL_SAMPLE_MS * 1000UL);
+	return min(filled, (unsigned long) ADXL345_FIFO_SIZE) - fifo_popped;
+}
+
+static void accel_sample() {
+	for(unsigned char i = 0; i < 3; i++) {
+		int v = host_accel[i] + noise();
+		accel_reg[Register_DataX + 2 * i] = v;
+		accel_reg[Register_DataX + 2 * i + 1] = v >> 8;
+	}
+}
+
+static boolean accel_read(uint8_t reg, int length, unsigned char *buffer) {
+	if(reg + length > (int) sizeof(accel_reg)) return false;
+	if(reg == Register_DataX) {
+		if(fifo_entries() > 0) fifo_popped++;
+		accel_sample();
+	}
+	accel_reg[Register_FifoStatus] = fifo_entries();
+	memcpy(buffer, &accel_reg[reg], length);
+	return true;
+}
+
+static void accel_write(uint8_t reg, uint8_t data) {
+	if(reg >= sizeof(accel_reg) || reg == 0x00) return;
+	if(reg == Register_FifoControl) {
+		fifo_start_us = sensor_us();
+		fifo_popped = 0;
+	}
+	accel_reg[reg] = data;
+}
+
+//---------------------------------------------------------------------------------
+// HMC5883L
+
+static uint8_t mag_reg[13];
+
+static void mag_reset() {
+	memset(mag_reg, 0, sizeof(mag_reg));
+	mag_reg[ConfigurationRegisterA] = 0x10;
+	mag_reg[ConfigurationRegisterB] = 0x20;
+	mag_reg[ModeRegister] = COMPASS_MEASURE_SINGLESHOT;
+	mag_reg[StatusRegister] = 0x01;
+	mag_reg[IdentityRegister] = 'H';
+	mag_reg[IdentityRegister + 1] = '4';
+	mag_reg[IdentityRegister + 2] = '3';
+}
+
+static boolean mag_read(uint8_t reg, int length, unsigned char *buffer) {
+	if(reg + length > (int) sizeof(mag_reg)) return false;
+	if(reg == DataRegisterBegin) {
+		//X, Z, Y, each big endian
+		static const unsigned char axis[3] = {0, 2, 1};
+		for(unsigned char i = 0; i < 3; i++) {
+			int v = host_mag[axis[i]] + noise();
+			mag_reg[DataRegisterBegin + 2 * i] = v >> 8;
+			mag_reg[DataRegisterBegin + 2 * i + 1] = v;
+		}
+		//A single measurement leaves the part idle
+		if(mag_reg[ModeRegister] == COMPASS_MEASURE_SINGLESHOT) mag_reg[ModeRegister] = COMPASS_MEASURE_IDLE;
+	}
+	memcpy(buffer, &mag_reg[reg], length);
+	return true;
+}
+
+static void mag_write(uint8_t reg, uint8_t data) {
+	if(reg <= ModeRegister) mag_reg[reg] = data;
+}
+
+//---------------------------------------------------------------------------------
+// I2C
+
+static boolean powered() {
+	static boolean was_powered = false;
+
+	if(digitalRead(PIN_SENSOR_POWER) != HIGH) {
+		was_powered = false;
+		return false;
+	}
+	if(!was_powered) {
+		accel_reset();
+		mag_reset();
+		was_powered = true;
+	}
+	return true;
+}
+
+int i2cread(int device, int address, int length, unsigned char *buffer) {
+	if(!powered()) return 0;
+	if(device == ADXL345_ADDRESS && accel_read(address, length, buffer)) return length;
+	if(device == HMC5883L_Address && mag_read(address, length, buffer)) return length;
+	return 0;
+}
+
+void i2cwrite(int device, int address, int data) {
+	if(!powered()) return;
+	if(device == ADXL345_ADDRESS) accel_write(address, data);
+	if(device == HMC5883L_Address) mag_write(address, data);
+}
+
+boolean i2cidentify(int device, unsigned char idregister, unsigned char regvalue) {
+	unsigned char data[1];
+	return i2cread(device, idregister, 1, data) == 1 && data[0] == regvalue;
+}
+
+//The drivers only reach the bus through the functions above
+TwoWire Wire;
+TwoWire::TwoWire() {}
+void TwoWire::begin() {}
+size_t TwoWire::write(uint8_t) { return 1; }
+size_t TwoWire::write(const uint8_t *, size_t size) { return size; }
+int TwoWire::available() { return 0; }
+int TwoWire::read() { return -1; }
+int TwoWire::peek() { return -1; }
+void TwoWire::flush() {}
+
+//---------------------------------------------------------------------------------
+// Watchdog sleeps
+
+NarcolepticClass Narcoleptic;
+
+void NarcolepticClass::delay(int milliseconds) {
+	slept_us += milliseconds * 1000UL;
+}
+
+void NarcolepticClass::delay8secs(int eightsecs) {
+	slept_us += eightsecs * 8000000UL;
+}
+
+//Timing a period keeps the processor idling, so millis() runs meanwhile
+unsigned long NarcolepticClass::measureWatchdog(uint8_t wdt_period) {
+	host_advance_us(500000);
+	return 500000;
+}
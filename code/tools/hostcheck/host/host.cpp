@@ -0,0 +1,304 @@
+#include "host.h"
+#include <avr/eeprom.h>
+
+volatile uint8_t PORTB, PORTC, PORTD, DDRB, DDRC, DDRD, PINB, PINC, PIND;
+volatile uint8_t SREG = 0x80, PRR, MCUSR, WDTCSR, ADMUX, ACSR, TWCR;
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1, GTCCR;
+volatile uint16_t ADC, ICR1, TCNT1, OCR1A, OCR1B;
+
+//---------------------------------------------------------------------------------
+// ADC. Only the bandgap is wired up, measured against AVcc as battery.cpp does.
+
+unsigned int host_vcc_mv = 5000;
+unsigned int host_bandgap_mv = 1100;
+HostAdcsra ADCSRA;
+
+HostAdcsra &HostAdcsra::operator=(uint8_t v) {
+	value = v;
+	if((value & _BV(ADEN)) && (value & _BV(ADSC))) {
+		ADC = min(((unsigned long) host_bandgap_mv * 1024) / host_vcc_mv, 1023UL);
+		value &= ~_BV(ADSC);
+	}
+	return *this;
+}
+
+//---------------------------------------------------------------------------------
+// Time, and Timer1
+
+unsigned long host_us = 0;
+unsigned long host_poll_us = 0;
+void (*host_timer1_hook)() = NULL;
+
+/*
+ * Timer1 as TimerOne sets it up, in phase and frequency correct mode: the overflow interrupt
+ * comes every 2 * ICR1 prescaled clocks, and a new ICR1 written in the interrupt sets the length
+ * of the cycle that has just begun. TCNT1 does not count, so TimerOne::start() and read() would
+ * never return, but the firmware uses neither. An overflow while the interrupt is masked is lost
+ * rather than taken late, which can only happen if a check moves time on with interrupts off.
+ */
+static unsigned long long timer1_next; //When the next overflow comes, in CPU clocks
+static boolean timer1_running = false;
+static boolean in_interrupt = false;
+
+#define CLOCKS_PER_US (F_CPU / 1000000)
+
+static unsigned long timer1_clocks() {
+	static const unsigned int prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+	return 2UL * ICR1 * prescale[TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))];
+}
+
+//Vectors the firmware does not define are never taken
+__attribute__((weak)) void TIMER1_OVF_vect() {
+}
+
+void host_advance_us(unsigned long us) {
+	unsigned long long end = (unsigned long long) (host_us + us) * CLOCKS_PER_US;
+
+	//Interrupts do not nest, as the AVR only takes them with the I flag set
+	while(!in_interrupt) {
+		if(timer1_clocks() == 0) {
+			timer1_running = false;
+			break;
+		}
+		if(!timer1_running) {
+			timer1_next = (unsigned long long) host_us * CLOCKS_PER_US + timer1_clocks();
+			timer1_running = true;
+		}
+		if(timer1_next > end) break;
+
+		host_us = timer1_next / CLOCKS_PER_US;
+		if((TIMSK1 & _BV(TOIE1)) && (SREG & _BV(SREG_I))) {
+			uint8_t sreg = SREG;
+			if(host_timer1_hook) host_timer1_hook();
+			in_interrupt = true;
+			cli();
+			TIMER1_OVF_vect();
+			SREG = sreg;
+			in_interrupt = false;
+		}
+		timer1_next += timer1_clocks();
+	}
+	host_us = end / CLOCKS_PER_US;
+}
+
+void host_advance_ms(unsigned long ms) {
+	host_advance_us(ms * 1000);
+}
+
+unsigned long millis() {
+	if(host_poll_us) host_advance_us(host_poll_us);
+	return host_us / 1000;
+}
+
+unsigned long micros() {
+	if(host_poll_us) host_advance_us(host_poll_us);
+	return host_us;
+}
+
+void delay(unsigned long ms) {
+	host_advance_ms(ms);
+}
+
+void delayMicroseconds(unsigned int us) {
+	host_advance_us(us);
+}
+
+//---------------------------------------------------------------------------------
+// EEPROM
+
+uint8_t host_eeprom[E2END + 1];
+unsigned long host_eeprom_writes[E2END + 1];
+
+void host_eeprom_erase() {
+	memset(host_eeprom, 0xFF, sizeof(host_eeprom));
+	memset(host_eeprom_writes, 0, sizeof(host_eeprom_writes));
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr) {
+	static boolean erased = false;
+
+	//A new part comes erased
+	if(!erased) {
+		host_eeprom_erase();
+		erased = true;
+	}
+	return host_eeprom[(uintptr_t) addr & E2END];
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value) {
+	eeprom_read_byte(addr);
+	host_eeprom[(uintptr_t) addr & E2END] = value;
+	host_eeprom_writes[(uintptr_t) addr & E2END]++;
+}
+
+//---------------------------------------------------------------------------------
+// Pins
+
+signed char host_pin_external[HOST_PINS] = {
+	HOST_FLOATING, HOST_FLOATING, HOST_FLOATING, HOST_FLOATING, HOST_FLOATING,
+	HOST_FLOATING, HOST_FLOATING, HOST_FLOATING, HOST_FLOATING, HOST_FLOATING,
+	HOST_FLOATING, HOST_FLOATING, HOST_FLOATING, HOST_FLOATING, HOST_FLOATING,
+	HOST_FLOATING, HOST_FLOATING, HOST_FLOATING, HOST_FLOATING, HOST_FLOATING
+};
+
+static uint8_t pin_mode[HOST_PINS];
+static uint8_t pin_out[HOST_PINS]; //The PORT bit: the output level, or the pull-up of an input
+static uint8_t pin_held[HOST_PINS] = {
+	HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH,
+	HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH, HIGH
+}; //What a floating input reads back. Nothing is known at reset, so assume the worst.
+
+void pinMode(uint8_t pin, uint8_t mode) {
+	if(pin >= HOST_PINS) return;
+	pin_mode[pin] = mode;
+	if(mode == INPUT_PULLUP) pin_out[pin] = HIGH;
+	if(mode == OUTPUT) pin_held[pin] = pin_out[pin];
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	if(pin >= HOST_PINS) return;
+	pin_out[pin] = val ? HIGH : LOW;
+	if(pin_mode[pin] == OUTPUT) pin_held[pin] = pin_out[pin];
+}
+
+int digitalRead(uint8_t pin) {
+	if(pin >= HOST_PINS) return LOW;
+	if(pin_mode[pin] == OUTPUT) return pin_out[pin];
+	if(host_pin_external[pin] != HOST_FLOATING) {
+		pin_held[pin] = host_pin_external[pin]; //Left charged at that level once let go
+		return host_pin_external[pin];
+	}
+	if(pin_out[pin]) return HIGH; //Pulled up
+	return pin_held[pin];
+}
+
+//---------------------------------------------------------------------------------
+// Piezo
+
+unsigned int host_tone = 0;
+void (*host_tone_hook)(unsigned int freq) = NULL;
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {
+	host_tone = frequency;
+	if(host_tone_hook) host_tone_hook(frequency);
+}
+
+void noTone(uint8_t pin) {
+	if(host_tone == 0) return;
+	host_tone = 0;
+	if(host_tone_hook) host_tone_hook(0);
+}
+
+//---------------------------------------------------------------------------------
+// Serial
+
+FILE *host_serial_out = NULL;
+boolean host_serial_open = false;
+static const char *serial_in = "";
+
+void host_serial_input(const char *s) {
+	serial_in = s;
+}
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud) {
+	host_serial_open = true;
+}
+
+void HardwareSerial::end() {
+	host_serial_open = false;
+}
+
+int HardwareSerial::available() {
+	return strlen(serial_in);
+}
+
+int HardwareSerial::read() {
+	if(*serial_in == 0) return -1;
+	return (unsigned char) *serial_in++;
+}
+
+int HardwareSerial::peek() {
+	if(*serial_in == 0) return -1;
+	return (unsigned char) *serial_in;
+}
+
+void HardwareSerial::flush() {
+	if(host_serial_out) fflush(host_serial_out);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	if(host_serial_out) fputc(c, host_serial_out);
+	return 1;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+	for(size_t i = 0; i < size; i++) write(buffer[i]);
+	return size;
+}
+
+size_t Print::print_number(unsigned long n, int base) {
+	char buf[8 * sizeof(long) + 1];
+	char *p = &buf[sizeof(buf) - 1];
+
+	*p = 0;
+	do {
+		unsigned char digit = n % base;
+		*--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+		n /= base;
+	} while(n > 0);
+	return print(p);
+}
+
+size_t Print::print(const __FlashStringHelper *s) { return print((const char *) s); }
+size_t Print::print(const char *s) { return write((const uint8_t *) s, strlen(s)); }
+size_t Print::print(char c) { return write((uint8_t) c); }
+size_t Print::print(unsigned char n, int base) { return print_number(n, base); }
+size_t Print::print(int n, int base) { return print((long) n, base); }
+size_t Print::print(unsigned int n, int base) { return print_number(n, base); }
+size_t Print::print(unsigned long n, int base) { return print_number(n, base); }
+
+size_t Print::print(long n, int base) {
+	if(n < 0 && base == 10) return print('-') + print_number(-n, base);
+	return print_number(n, base);
+}
+
+size_t Print::print(double n, int digits) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.*f", digits, n);
+	return print(buf);
+}
+
+size_t Print::println() { return print("\r\n"); }
+size_t Print::println(const __FlashStringHelper *s) { return print(s) + println(); }
+size_t Print::println(const char *s) { return print(s) + println(); }
+size_t Print::println(char c) { return print(c) + println(); }
+size_t Print::println(unsigned char n, int base) { return print(n, base) + println(); }
+size_t Print::println(int n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned int n, int base) { return print(n, base) + println(); }
+size_t Print::println(long n, int base) { return print(n, base) + println(); }
+size_t Print::println(unsigned long n, int base) { return print(n, base) + println(); }
+size_t Print::println(double n, int digits) { return print(n, digits) + println(); }
+
+//---------------------------------------------------------------------------------
+// Checks
+
+static unsigned int checks = 0;
+static unsigned int failures = 0;
+
+void host_check(boolean ok, const char *what, const char *file, int line) {
+	checks++;
+	if(ok) return;
+	failures++;
+	fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+}
+
+int host_done() {
+	fprintf(stderr, "%u checks, %u failed\n", checks, failures);
+	return failures == 0 ? 0 : 1;
+}
+
+//Checks that do not build tokenlog.cpp drop log messages
+__attribute__((weak)) void log_token(unsigned int id, unsigned char nargs, long a, long b, long c) {
+}
@@ -0,0 +1,62 @@
+#ifndef HOST_H
+#define HOST_H
+
+/*
+ * Host harness for the firmware checks in tools/hostcheck (see check.sh).
+ *
+ * The firmware modules are built unchanged against the headers in this directory, which model
+ * the parts of the ATmega328 and the Arduino core that they use. Everything is deterministic:
+ * time only moves through host_advance_us() (or the firmware calling delay()), the EEPROM
+ * starts erased, and pins read whatever the check says the outside world is doing.
+ */
+
+#include "Arduino.h"
+#include <stdio.h>
+
+//Simulated time since reset. Moving it on runs the Timer1 overflow interrupt (e.g. the LED scanner)
+//each time it is due, calling host_timer1_hook first if it is set.
+extern unsigned long host_us;
+void host_advance_us(unsigned long us);
+void host_advance_ms(unsigned long ms);
+extern void (*host_timer1_hook)();
+
+//If set, each millis() or micros() call moves time on this much, so that firmware which
+//polls the clock in a loop (e.g. play_animation()) makes progress
+extern unsigned long host_poll_us;
+
+//The EEPROM, and how many times each cell has been written
+extern uint8_t host_eeprom[E2END + 1];
+extern unsigned long host_eeprom_writes[E2END + 1];
+void host_eeprom_erase();
+
+//What is driving each pin from outside: HOST_FLOATING, LOW or HIGH. A floating pin reads back
+//the level it was last driven to, by the firmware or from outside (the pin capacitance holds
+//it), or its pull-up.
+#define HOST_PINS 20
+#define HOST_FLOATING -1
+extern signed char host_pin_external[HOST_PINS];
+
+//Serial output is written to host_serial_out if it is set, and input is taken from host_serial_input()
+extern FILE *host_serial_out;
+void host_serial_input(const char *s);
+extern boolean host_serial_open;
+
+//The supply and the bandgap it is measured against (see ADCSRA in avr/io.h)
+extern unsigned int host_vcc_mv;
+extern unsigned int host_bandgap_mv;
+
+//The note the piezo is playing (0 for silence), and a hook called on every change
+extern unsigned int host_tone;
+extern void (*host_tone_hook)(unsigned int freq);
+
+//With host/board.cpp built too, for checks of the whole firmware: the field the sensors measure,
+//in raw units (256 per G for the accelerometer at full resolution)
+extern int host_accel[3];
+extern int host_mag[3];
+
+//Checks. Failures are reported as they happen, and host_done() gives main()'s exit status.
+#define CHECK(cond) host_check((cond), #cond, __FILE__, __LINE__)
+void host_check(boolean ok, const char *what, const char *file, int line);
+int host_done();
+
+#endif
@@ -0,0 +1,163 @@
+#!/usr/bin/env python
+"""
+Report the SRAM used by each module of a JaCube build against a budget.
+
+The Arduino IDE builds into a temporary directory (shown with verbose compile
+output enabled in the preferences), holding an object file per source file and
+the linked jacube.cpp.elf. Point this script at it:
+
+    python ram_report.py /tmp/build1234.tmp
+
+For each object this lists .data (initialised variables, copied to RAM at boot),
+.rodata (constant tables and string literals NOT marked PROGMEM, which on the AVR
+also live in RAM) and .bss, then the totals and the headroom left for the stack.
+Anything appearing under rodata is a candidate for PROGMEM or F().
+
+Budgets are given per module (the object name without extension), or for the
+whole image with --stack, the RAM to keep free for the stack:
+
+    python ram_report.py build/ --stack 512 --budget leds=40 --budget HardwareSerial=160
+
+If the sources were compiled with -fstack-usage, the largest stack frame in each
+module is shown too. Exits non-zero if any budget is exceeded. Needs avr-objdump
+on the PATH, or give --tools with the directory holding it (e.g.
+hardware/tools/avr/bin in the Arduino install).
+"""
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+RAM_SIZE = 2048  #ATmega328
+
+SECTION_RE = re.compile(r"^\s*\d+\s+(\S+)\s+([0-9a-fA-F]+)\s")
+
+
+def section_sizes(objdump, path):
+    """Sizes of the RAM sections of an object or ELF file, as (data, rodata, bss)."""
+    out = subprocess.check_output([objdump, "-h", path]).decode("ascii", "replace")
+    data = rodata = bss = 0
+    for line in out.splitlines():
+        m = SECTION_RE.match(line)
+        if not m:
+            continue
+        name, size = m.group(1), int(m.group(2), 16)
+        if name.startswith(".rodata"):
+            rodata += size
+        elif name.startswith(".data"):
+            data += size
+        elif name.startswith(".bss") or name.startswith(".noinit"):
+            bss += size
+    return data, rodata, bss
+
+
+def common_size(nm, path):
+    """C tentative definitions are not in any section until linked"""
+    out = subprocess.check_output([nm, "-S", path]).decode("ascii", "replace")
+    total = 0
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 4 and parts[2] == "C":
+            total += int(parts[1], 16)
+    return total
+
+
+def largest_frames(builddir):
+    """Largest stack frame per module from the .su files of -fstack-usage"""
+    frames = {}
+    for path in glob.glob(os.path.join(builddir, "*.su")):
+        module = module_name(path)
+        with open(path) as f:
+            for line in f:
+                parts = line.rstrip("\n").split("\t")
+                if len(parts) >= 2 and parts[1].isdigit():
+                    frames[module] = max(frames.get(module, 0), int(parts[1]))
+    return frames
+
+
+def module_name(path):
+    name = os.path.basename(path)
+    for ext in (".su", ".o"):
+        if name.endswith(ext):
+            name = name[:-len(ext)]
+    for ext in (".cpp", ".c"):
+        if name.endswith(ext):
+            name = name[:-len(ext)]
+    return name
+
+
+def parse_budgets(items):
+    budgets = {}
+    for item in items:
+        name, _, size = item.partition("=")
+        if not size.isdigit():
+            raise SystemExit("bad budget {!r}, expected module=bytes".format(item))
+        budgets[name] = int(size)
+    return budgets
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Report the SRAM used by each module of a JaCube build")
+    parser.add_argument("builddir", help="Arduino IDE build directory")
+    parser.add_argument("--stack", type=int, default=512, help="RAM to keep free for the stack (default 512)")
+    parser.add_argument("--budget", action="append", default=[], metavar="MODULE=BYTES",
+                        help="static RAM budget of one module")
+    parser.add_argument("--tools", help="directory holding avr-objdump and avr-nm")
+    args = parser.parse_args()
+
+    objdump = os.path.join(args.tools, "avr-objdump") if args.tools else "avr-objdump"
+    nm = os.path.join(args.tools, "avr-nm") if args.tools else "avr-nm"
+    budgets = parse_budgets(args.budget)
+    frames = largest_frames(args.builddir)
+
+    objects = sorted(glob.glob(os.path.join(args.builddir, "*.o")))
+    if not objects:
+        raise SystemExit("no object files in {}".format(args.builddir))
+
+    failed = False
+    rows = []
+    for path in objects:
+        data, rodata, bss = section_sizes(objdump, path)
+        bss += common_size(nm, path)
+        rows.append((module_name(path), data, rodata, bss))
+    rows.sort(key=lambda r: r[1] + r[2] + r[3], reverse=True)
+
+    print("{:<20} {:>6} {:>6} {:>6} {:>6} {:>7} {:>6}".format("module", "data", "rodata", "bss", "total", "budget", "frame"))
+    for name, data, rodata, bss in rows:
+        total = data + rodata + bss
+        budget = budgets.get(name)
+        over = budget is not None and total > budget
+        failed = failed or over
+        if total == 0 and name not in frames:
+            continue
+        print("{:<20} {:>6} {:>6} {:>6} {:>6} {:>7} {:>6}{}".format(
+            name, data, rodata, bss, total, "" if budget is None else budget,
+            frames.get(name, ""), "  OVER" if over else ""))
+
+    unknown = set(budgets) - set(r[0] for r in rows)
+    for name in sorted(unknown):
+        sys.stderr.write("warning: no object for budgeted module {}\n".format(name))
+
+    #The linked image is authoritative, as the linker drops unused sections
+    elfs = glob.glob(os.path.join(args.builddir, "*.elf"))
+    if elfs:
+        data, rodata, bss = section_sizes(objdump, elfs[0])
+        static = data + rodata + bss
+        source = os.path.basename(elfs[0])
+    else:
+        static = sum(r[1] + r[2] + r[3] for r in rows)
+        source = "sum of objects, before unused sections are dropped"
+
+    headroom = RAM_SIZE - static
+    print("\nstatic RAM {} of {} bytes ({}), {} left for the stack (budget {}){}".format(
+        static, RAM_SIZE, source, headroom, args.stack, "  OVER" if headroom < args.stack else ""))
+    failed = failed or headroom < args.stack
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
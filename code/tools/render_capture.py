@@ -0,0 +1,203 @@
+#!/usr/bin/env python
+"""
+Render JaCube animation captures to frame files, PNG strips and WAVs.
+
+Build the firmware with ANIMATION_CAPTURE defined in options.h. At boot it plays
+every happy animation once and writes each frame and note to the serial line
+(see src/capture.cpp). No cube is needed: tools/hostcheck/check_capture.cpp builds
+the same firmware for the host, with the LED scanner on mock pins, and writes the
+capture to the file named by CAPTURE:
+
+    CAPTURE=capture.txt tools/hostcheck/check.sh capture
+
+Otherwise record the serial output of a cube. Pass the capture to this script,
+either as a file or on stdin:
+
+    python render_capture.py capture.txt out/
+
+For each animation this writes out/anim<id>.frames, anim<id>.png (one column per
+frame, one row per LED) and anim<id>.wav (the piezo as a square wave).
+
+To check that a change has not altered any animation, compare against frame files
+rendered earlier:
+
+    python render_capture.py capture.txt out/ --golden golden/
+
+Exits non-zero if any animation differs. Host captures repeat exactly, so golden
+files are best made from them. On a cube the random animations (e.g. Twinkle) only
+match if it is seeded identically.
+
+A .frames file is "JCF1", the LED count (1 byte), the frame count (uint32 LE), then
+for each frame the time in ms (uint32 LE) and r, g, b for each LED.
+"""
+
+import argparse
+import math
+import os
+import struct
+import sys
+import wave
+import zlib
+
+SAMPLE_RATE = 16000
+
+
+class Capture(object):
+    def __init__(self, anim_id):
+        self.id = anim_id
+        self.frames = []  #(ms, [(r, g, b), ...])
+        self.tones = []  #(ms, freq)
+
+
+def parse(lines):
+    captures = []
+    cur = None
+    for line in lines:
+        parts = line.strip().split()
+        if not parts:
+            continue
+        if parts[0] == "ANIM" and len(parts) == 2:
+            cur = Capture(int(parts[1], 16))
+        elif cur is None:
+            continue
+        elif parts[0] == "F" and len(parts) == 3:
+            data = bytearray.fromhex(parts[2])
+            leds = [tuple(data[i:i + 3]) for i in range(0, len(data), 3)]
+            cur.frames.append((int(parts[1], 16), leds))
+        elif parts[0] == "T" and len(parts) == 3:
+            cur.tones.append((int(parts[1], 16), int(parts[2], 16)))
+        elif parts[0] == "END":
+            captures.append(cur)
+            cur = None
+    return captures
+
+
+def frames_bytes(cap):
+    numleds = len(cap.frames[0][1]) if cap.frames else 0
+    out = bytearray(b"JCF1") + struct.pack("<BI", numleds, len(cap.frames))
+    for ms, leds in cap.frames:
+        out += struct.pack("<I", ms)
+        for c in leds:
+            out += bytearray(c)
+    return bytes(out)
+
+
+def read_frames(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"JCF1":
+        raise ValueError("{} is not a frame file".format(path))
+    numleds, count = struct.unpack("<BI", data[4:9])
+    frames = []
+    pos = 9
+    for _ in range(count):
+        ms = struct.unpack("<I", data[pos:pos + 4])[0]
+        pos += 4
+        leds = [tuple(bytearray(data[pos + i * 3:pos + i * 3 + 3])) for i in range(numleds)]
+        pos += numleds * 3
+        frames.append((ms, leds))
+    return frames
+
+
+def write_png(path, cap, scanmax, size):
+    """One size x size square per LED per frame, frames left to right."""
+    numleds = len(cap.frames[0][1]) if cap.frames else 0
+    width = max(1, len(cap.frames)) * size
+    height = max(1, numleds) * size
+
+    def level(v):
+        return min(v, scanmax) * 255 // scanmax
+
+    rows = []
+    for led in range(numleds):
+        row = bytearray()
+        for _, leds in cap.frames:
+            row += bytearray([level(v) for v in leds[led]]) * size
+        rows += [b"\x00" + bytes(row)] * size
+    if not rows:
+        rows = [b"\x00\x00\x00\x00"]
+
+    def chunk(kind, data):
+        return struct.pack(">I", len(data)) + kind + data + struct.pack(">I", zlib.crc32(kind + data) & 0xFFFFFFFF)
+
+    png = b"\x89PNG\r\n\x1a\n"
+    png += chunk(b"IHDR", struct.pack(">IIBBBBB", width, height, 8, 2, 0, 0, 0))
+    png += chunk(b"IDAT", zlib.compress(b"".join(rows), 9))
+    png += chunk(b"IEND", b"")
+    with open(path, "wb") as f:
+        f.write(png)
+
+
+def write_wav(path, cap):
+    end_ms = max([ms for ms, _ in cap.frames] + [ms for ms, _ in cap.tones] + [0])
+    samples = bytearray(SAMPLE_RATE * end_ms // 1000)
+    tones = cap.tones + [(end_ms, 0)]
+    for (start, freq), (stop, _) in zip(tones, tones[1:]):
+        for i in range(SAMPLE_RATE * start // 1000, SAMPLE_RATE * stop // 1000):
+            if freq == 0:
+                samples[i] = 128
+            else:
+                samples[i] = 192 if math.fmod(i * freq / float(SAMPLE_RATE), 1.0) < 0.5 else 64
+    for i in range(SAMPLE_RATE * tones[0][0] // 1000):
+        samples[i] = 128
+    w = wave.open(path, "wb")
+    w.setnchannels(1)
+    w.setsampwidth(1)
+    w.setframerate(SAMPLE_RATE)
+    w.writeframes(bytes(samples))
+    w.close()
+
+
+def compare(cap, golden_path):
+    """Returns None if the frames match the golden file, or a description of the first difference.
+    Only the LED values are compared, as capture timing varies from run to run."""
+    golden = read_frames(golden_path)
+    for i, ((_, leds), (_, gleds)) in enumerate(zip(cap.frames, golden)):
+        if leds != gleds:
+            return "frame {} differs: {} (golden {})".format(i, leds, gleds)
+    if len(cap.frames) != len(golden):
+        return "{} frames (golden {})".format(len(cap.frames), len(golden))
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Render JaCube animation captures")
+    parser.add_argument("capture", nargs="?", help="captured serial output (default stdin)")
+    parser.add_argument("outdir")
+    parser.add_argument("--golden", help="directory of .frames files to compare against")
+    parser.add_argument("--scanmax", type=int, default=8, help="LED_SCANMAX of the firmware")
+    parser.add_argument("--size", type=int, default=4, help="pixels per LED per frame in the PNG")
+    args = parser.parse_args()
+
+    if args.capture:
+        with open(args.capture) as f:
+            captures = parse(f)
+    else:
+        captures = parse(sys.stdin)
+
+    if not os.path.isdir(args.outdir):
+        os.makedirs(args.outdir)
+
+    failed = False
+    for cap in captures:
+        base = os.path.join(args.outdir, "anim{}".format(cap.id))
+        with open(base + ".frames", "wb") as f:
+            f.write(frames_bytes(cap))
+        write_png(base + ".png", cap, args.scanmax, args.size)
+        write_wav(base + ".wav", cap)
+        status = ""
+        if args.golden:
+            golden = os.path.join(args.golden, "anim{}.frames".format(cap.id))
+            if not os.path.exists(golden):
+                status = "  (no golden)"
+            else:
+                diff = compare(cap, golden)
+                status = "  OK" if diff is None else "  CHANGED: " + diff
+                failed = failed or diff is not None
+        print("anim{}: {} frames, {} notes{}".format(cap.id, len(cap.frames), len(cap.tones), status))
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,600 @@
+#!/usr/bin/env python
+"""
+Monte Carlo simulator of the JaCube's behaviour.
+
+Runs a model of the behaviour state machine (src/behaviour.cpp) on a virtual clock
+for many simulated weeks, with the cube handled by a stochastic user, and reports
+the distribution of unhappy episodes, apoplexy entries, animations, nose changes
+and energy used. Use it to tune the behaviour settings before flashing them.
+
+The behaviour defaults are read from src/options.h. Any setting can be overridden,
+and any number of settings swept over a grid, which is run across all cores:
+
+    python simulate_behaviour.py --weeks 52 --runs 200
+    python simulate_behaviour.py --set rotations_per_week=5 --sweep apoplexy_threshold=1200,2400,4800 > sweep.csv
+
+Settings are the configuration record fields (nose_anims_min, nose_anims_max,
+anim_gap_min, anim_gap_max, apoplexy_threshold, apoplexy_sleep, vibrate_threshold),
+in the same units as the firmware, plus the user, energy and battery models below.
+
+The battery model discharges a 4xAA pack through the 5V regulator, and the cube
+measures it as src/battery.cpp does, scaling back its animations, vibration and LED
+brightness as the supply falls. Start part way through a pack to see the policy at
+work, and give the bandgap an error to see an uncalibrated cube:
+
+    python simulate_behaviour.py --set start_used_pct=80 --sweep bandgap_error_pct=-10,0,10
+
+Each phase (orientation check, boot, animation, ...) draws the awake current, plus
+each on-chip peripheral the firmware holds in that phase (see src/peripherals.cpp and
+PHASES below), plus its LEDs, piezo and motor. --list shows the current of every phase,
+and the time and charge a boot takes against the old boot, which waited a second for a
+key at the serial prompt and powered the sensors up separately for the entropy. To
+run with the old boot:
+
+    python simulate_behaviour.py --sweep old_boot=0,1
+
+This is a model, not the firmware. The currents are estimates, to be replaced with
+measurements. To keep it in step with the firmware, --check compares the state
+transitions in TRANSITIONS with those in behaviour.cpp, the settings with the
+behaviour timings of the configuration record in config.h, and PERIPHERALS with the
+peripherals of peripherals.h. tools/hostcheck/check.sh
+runs it.
+"""
+
+import argparse
+import itertools
+import multiprocessing
+import os
+import random
+import re
+import sys
+
+SRC = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src")
+OPTIONS_H = os.path.join(SRC, "options.h")
+
+#The transitions between the states of behaviour.cpp that this model takes
+TRANSITIONS = set([
+    ("HAPPY_CHECK", "UNHAPPY"),  #Someone turned the cube, or the nose changed
+    ("HAPPY_CHECK", "ANIMATING"),
+    ("HAPPY_CHECK", "PACIFIED"),
+    ("ANIMATING", "HAPPY_CHECK"),
+    ("UNHAPPY", "HAPPY_CHECK"),  #Put right
+    ("UNHAPPY", "APOPLECTIC"),
+    ("APOPLECTIC", "UNHAPPY"),  #Poked, or slept it off
+    ("PACIFIED", "HAPPY_CHECK"),
+])
+
+#User model
+USER = {
+    "rotations_per_week": 2.0,  #Times the cube gets knocked or turned away, while someone is around
+    "response_mins": 3.0,  #Mean time for someone present to put the cube right
+    "magnet_probability": 0.05,  #Chance that the response is to pacify the cube rather than turn it
+    "magnet_hours": 8.0,  #Mean time a pacification magnet is left on
+    "office_hours": 1,  #1: someone is only around 09:00-17:30 on weekdays. 0: always.
+    "boot_wrong_probability": 0.5,  #Chance that the cube is facing the wrong way when the batteries go in
+}
+
+#Energy model. Currents in mA, times in seconds.
+ENERGY = {
+    "sleep_ma": 0.15,  #Power-down sleep, including the regulator
+    "awake_ma": 11.5,  #Awake with every peripheral gated: the core at 16MHz, the regulator and the sensors
+    #Each on-chip peripheral while it is clocked, roughly twice the datasheet's figures at 5V 8MHz
+    "twi_ma": 0.41,
+    "timer1_ma": 0.31,
+    "timer2_ma": 0.49,
+    "usart_ma": 0.23,
+    "adc_ma": 0.92,
+    "wake_secs": 0.03,  #An orientation check
+    "boot_secs": 0.5,  #Reset to the first decision, including the sensor bring-up and entropy
+    "old_boot": 0,  #1: boot as it was before the command shell, adding the two costs below
+    "prompt_secs": 1.0,  #The old boot's wait for a key, with the USART on
+    "entropy_cycle_secs": 0.012,  #The old boot's own sensor power cycle for the entropy, brought up again by the first check
+    "battery_secs": 0.0025,  #A battery measurement, every battery_sample_secs
+    "anim_ma": 13.0,  #LEDs and piezo while playing a happy animation
+    "anim_secs": 6.0,
+    "unhappy_ma": 28.0,  #LEDs and piezo while freaking out
+    "vibrate_ma": 60.0,  #Additional, once vibrating
+    "pulse_ma": 18.0,  #LEDs of the red pulse while apoplectic
+    "pulse_secs": 0.76,
+    "capacity_mah": 2000.0,  #4xAA alkaline pack, usable
+}
+
+#The peripherals the firmware holds in each phase, as peripherals_active() would report them.
+#Sensing holds the TWI (enable_sensors()), play_animation() the TWI, Timer1 for the LED scanner
+#and Timer2 for tone(), pulse_red() Timer1 in an apoplectic wake which has the sensors up, and
+#battery_measure_mv() the ADC. The USART is only held while a host is attached, which is not modelled,
+#and at the old boot's prompt.
+PERIPHERALS = ["twi", "timer1", "timer2", "usart", "adc"]
+PHASES = {
+    "wake": ["twi"],
+    "boot": ["twi"],
+    "prompt": ["usart"],
+    "battery": ["adc"],
+    "anim": ["twi", "timer1", "timer2"],
+    "unhappy": ["twi", "timer1", "timer2"],
+    "pulse": ["twi", "timer1"],
+}
+
+#Battery model. The regulator holds Vcc until the pack is within its dropout of the output.
+BATTERY = {
+    "cells": 4,
+    "regulator_mv": 5000,
+    "dropout_mv": 200,
+    "start_used_pct": 0.0,  #How much of the pack was used before the run
+    "bandgap_error_pct": 0.0,  #How far the part's bandgap is from config.bandgap_mv (0 once calibrated with "cal vcc")
+}
+
+#Voltage of an alkaline AA cell at a light load against the fraction of its capacity used
+CELL_CURVE = [(0.0, 1550), (0.05, 1450), (0.2, 1350), (0.4, 1270), (0.6, 1200), (0.8, 1120),
+              (0.9, 1060), (0.95, 1000), (1.0, 900)]
+
+METRICS = ["unhappy_per_week", "apoplexy_per_week", "anims_per_day", "nose_changes_per_week",
+           "pacified_per_week", "unhappy_mins_per_week", "mah_per_day", "battery_days", "battery_level_end"]
+
+DAY = 86400.0
+WEEK = 7 * DAY
+
+
+def read_options(path=OPTIONS_H):
+    """Evaluate the numeric #defines of options.h, with C integer division."""
+    defines = {}
+    helpers = {}
+    with open(path) as f:
+        text = f.read()
+    for name, args, body in re.findall(r"^#define (\w+)\((\w+)\) (.*)$", text, re.M):
+        helpers[name] = (args, body)
+    for name, body in re.findall(r"^#define (\w+) (.+)$", text, re.M):
+        expr = body.split("//")[0].strip()
+        for _ in range(4):
+            for hname, (harg, hbody) in helpers.items():
+                expr = re.sub(r"\b{}\(([^()]*)\)".format(hname),
+                              lambda m, harg=harg, hbody=hbody: "(" + re.sub(r"\b{}\b".format(harg), "(" + m.group(1) + ")", hbody) + ")",
+                              expr)
+        expr = re.sub(r"\b[A-Z_][A-Z0-9_]*\b", lambda m: str(defines.get(m.group(0), m.group(0))), expr)
+        try:
+            defines[name] = int(eval(expr.replace("/", "//"), {"__builtins__": {}}))
+        except Exception:
+            pass
+    return defines
+
+
+def default_settings():
+    o = read_options()
+    s = {
+        "tick_ms": o["TICK_MS"],
+        "check_8secs": o["BEHAVIOUR_CHECK_8SECS"],
+        "apoplexy_check_8secs": o["BEHAVIOUR_APOPLEXY_CHECK_8SECS"],
+        "apoplexy_pulse_wakes": o["BEHAVIOUR_APOPLEXY_PULSE_WAKES"],
+        "led_scanmax": o["LED_SCANMAX"],
+        "bandgap_mv": o["BANDGAP_MV"],
+        "battery_sample_secs": o["BATTERY_SAMPLE_SECS"],
+        "battery_good_mv": o["BATTERY_GOOD_MV"],
+        "battery_flat_mv": o["BATTERY_FLAT_MV"],
+    }
+    #Configuration record fields, from their defaults (see config.cpp)
+    s["nose_anims_min"] = o["DEFAULT_ANIMS_BETWEEN_NOSE_CHANGES_MIN"]
+    s["nose_anims_max"] = o["DEFAULT_ANIMS_BETWEEN_NOSE_CHANGES_MAX"]
+    s["anim_gap_min"] = o["DEFAULT_TIME_BETWEEN_ANIMS_8SECS_MIN"]
+    s["anim_gap_max"] = o["DEFAULT_TIME_BETWEEN_ANIMS_8SECS_MAX"]
+    s["apoplexy_threshold"] = o["DEFAULT_APOPLEXY_THRESHOLD"]
+    s["apoplexy_sleep"] = o["DEFAULT_APOPLEXY_SLEEP_8SECS"]
+    s["vibrate_threshold"] = o["DEFAULT_VIBRATE_THRESHOLD"]
+    s.update(USER)
+    s.update(ENERGY)
+    s.update(BATTERY)
+    return s
+
+
+def phase_ma(s, phase):
+    """The current of the core and the peripherals held in a phase."""
+    return s["awake_ma"] + sum(s[p + "_ma"] for p in PHASES[phase])
+
+
+def boot_cost(s, old):
+    """Seconds and mA seconds from reset to the first decision, as booted now or as before
+    the command shell. The watchdog calibration which boot used to run now runs before the
+    first sleep instead, so it costs the same either way and is left out of both."""
+    secs = s["boot_secs"]
+    mas = secs * phase_ma(s, "boot")
+    if old:
+        secs += s["prompt_secs"] + s["entropy_cycle_secs"]
+        mas += s["prompt_secs"] * phase_ma(s, "prompt") + s["entropy_cycle_secs"] * phase_ma(s, "boot")
+    return secs, mas
+
+
+def print_boot(s):
+    """The cost of a boot now, and what the old boot added."""
+    secs, mas = boot_cost(s, False)
+    old_secs, old_mas = boot_cost(s, True)
+    print("boot {:.2f} s {:.4f} mAh, the old boot {:.2f} s {:.4f} mAh: {:.2f} s {:.4f} mAh saved per boot".format(
+        secs, mas / 3600, old_secs, old_mas / 3600, old_secs - secs, (old_mas - mas) / 3600))
+
+
+def cell_mv(used):
+    """Interpolate CELL_CURVE."""
+    used = min(max(used, 0.0), 1.0)
+    for (u0, v0), (u1, v1) in zip(CELL_CURVE, CELL_CURVE[1:]):
+        if used <= u1:
+            return v0 + (v1 - v0) * (used - u0) / (u1 - u0)
+    return CELL_CURVE[-1][1]
+
+
+def vcc_mv(s, used):
+    """The supply with the given fraction of the pack used."""
+    return min(s["regulator_mv"], s["cells"] * cell_mv(used) - s["dropout_mv"])
+
+
+def measured_mv(s, used):
+    """What battery_measure_mv() reads: the ADC converts the true bandgap against Vcc,
+    and the firmware scales by the bandgap it was told."""
+    bandgap = s["bandgap_mv"] * (1 + s["bandgap_error_pct"] / 100.0)
+    reading = min(1023, int(bandgap * 1024 / vcc_mv(s, used)))
+    return s["bandgap_mv"] * 1024 // reading
+
+
+def used_at_flat(s):
+    """The fraction of the pack used when the cube measures BATTERY_FLAT_MV."""
+    lo, hi = 0.0, 1.0
+    for _ in range(30):
+        mid = (lo + hi) / 2
+        if measured_mv(s, mid) > s["battery_flat_mv"]:
+            lo = mid
+        else:
+            hi = mid
+    return hi
+
+
+def between(rng, lo, hi):
+    """random16(lo, hi): lo to hi - 1, or lo if the range is empty."""
+    return lo if hi <= lo else rng.randrange(int(lo), int(hi))
+
+
+class Simulation(object):
+    def __init__(self, s, seed):
+        self.s = s
+        self.rng = random.Random(seed)
+        self.t = 0.0
+        self.mas = 0.0  #Charge used, mA seconds
+        self.counts = dict((m, 0) for m in ["unhappy", "apoplexy", "anims", "nose_changes", "pacified"])
+        self.unhappy_secs = 0.0
+        self.start_mas = s["start_used_pct"] / 100.0 * s["capacity_mah"] * 3600
+        self.level = 255
+        self.sampled_at = None
+        self.flat_at = None
+
+    def used(self):
+        return (self.start_mas + self.mas) / 3600.0 / self.s["capacity_mah"]
+
+    def battery_update(self):
+        """As battery_update(), called on every wake."""
+        s = self.s
+        if self.sampled_at is not None and self.t - self.sampled_at < s["battery_sample_secs"]:
+            return
+        self.sampled_at = self.t
+        self.mas += s["battery_secs"] * phase_ma(s, "battery")
+        mv = measured_mv(s, self.used())
+        if mv >= s["battery_good_mv"]:
+            self.level = 255
+        elif mv <= s["battery_flat_mv"]:
+            self.level = 0
+        else:
+            self.level = (mv - s["battery_flat_mv"]) * 255 // (s["battery_good_mv"] - s["battery_flat_mv"])
+        if self.level == 0 and self.flat_at is None:
+            self.flat_at = self.t
+
+    def led_dim(self):
+        """The fraction of full brightness the LEDs are scanned at (set_led_scan_period()).
+        The LEDs are taken to draw all of anim_ma, unhappy_ma and pulse_ma."""
+        scanmax = self.s["led_scanmax"]
+        return float(scanmax) / (scanmax + scanmax * (255 - self.level) // 255)
+
+    def vibrate_duty(self):
+        """battery_vibrate_duty(), as a fraction."""
+        return ((self.level + 63) // 64) / 4.0
+
+    def present(self, t):
+        if not self.s["office_hours"]:
+            return True
+        day = int(t // DAY) % 7
+        hour = (t % DAY) / 3600.0
+        return day < 5 and 9.0 <= hour < 17.5
+
+    def next_presence(self, t):
+        """The first time at or after t that someone is around."""
+        while not self.present(t):
+            t = (t // 1800 + 1) * 1800
+        return t
+
+    def next_rotation(self, t):
+        """Rotations only happen while someone is around, so thin a Poisson process."""
+        rate = self.s["rotations_per_week"] / WEEK
+        if rate <= 0:
+            return float("inf")
+        while True:
+            t += self.rng.expovariate(rate)
+            if self.present(t):
+                return t
+
+    def response_time(self, t):
+        """How long until someone puts the cube right, from t."""
+        return self.next_presence(t) - t + self.rng.expovariate(1.0 / (self.s["response_mins"] * 60))
+
+    def anim_gap(self):
+        gap = between(self.rng, self.s["anim_gap_min"], self.s["anim_gap_max"])
+        return (gap + gap * 3 * (255 - self.level) // 255) * 8.0  #battery_stretch()
+
+    def nose_anims(self):
+        return between(self.rng, self.s["nose_anims_min"], self.s["nose_anims_max"])
+
+    def sleep(self, secs, wake_every=None):
+        """Power-down sleep with a sensor check every wake_every 8 second periods."""
+        s = self.s
+        wakes = secs / (8.0 * (wake_every or s["check_8secs"]))
+        self.mas += secs * s["sleep_ma"] + wakes * s["wake_secs"] * phase_ma(s, "wake")
+        self.t += secs
+
+    def play_anim(self):
+        self.mas += self.s["anim_secs"] * (phase_ma(self.s, "anim") + self.s["anim_ma"] * self.led_dim())
+        self.t += self.s["anim_secs"]
+
+    def freak_out(self, secs):
+        """secs of the Unhappy animation, vibrating after vibrate_threshold ticks."""
+        s = self.s
+        vibrate_after = s["vibrate_threshold"] * s["tick_ms"] / 1000.0
+        self.mas += (secs * (phase_ma(s, "unhappy") + s["unhappy_ma"] * self.led_dim())
+                     + max(0.0, secs - vibrate_after) * s["vibrate_ma"] * self.vibrate_duty())
+        self.t += secs
+        self.unhappy_secs += secs
+
+    def unhappy(self):
+        """An unhappy episode, until someone puts the cube right or pacifies it."""
+        s = self.s
+        self.counts["unhappy"] += 1
+        fix_at = self.t + self.response_time(self.t)
+        freak_secs = s["apoplexy_threshold"] * s["tick_ms"] / 1000.0
+        apoplexy_period = 8.0 * s["apoplexy_check_8secs"]
+        apoplexy_secs = s["apoplexy_sleep"] * apoplexy_period
+
+        while True:
+            if fix_at - self.t <= freak_secs:
+                self.freak_out(fix_at - self.t)
+                break
+            self.freak_out(freak_secs)
+
+            #Apoplectic. The fix is noticed as a poke at the next wake.
+            self.counts["apoplexy"] += 1
+            sleep_secs = min(apoplexy_secs, fix_at - self.t)
+            sleep_secs = apoplexy_period * int(-(-sleep_secs // apoplexy_period))
+            pulses = int(sleep_secs / apoplexy_period) // s["apoplexy_pulse_wakes"]
+            self.sleep(sleep_secs, s["apoplexy_check_8secs"])
+            self.mas += pulses * s["pulse_secs"] * (phase_ma(s, "pulse") + s["pulse_ma"] * self.led_dim())
+            self.battery_update()
+            self.unhappy_secs += sleep_secs
+            if self.t >= fix_at:
+                break
+
+        if self.rng.random() < s["magnet_probability"]:
+            #Pacified rather than turned. Whoever takes the magnet off turns it right.
+            self.counts["pacified"] += 1
+            self.sleep(self.rng.expovariate(1.0 / (s["magnet_hours"] * 3600)))
+        else:
+            self.play_anim()  #HappyAnim
+
+    def boot(self):
+        """Reset to the first decision. The first orientation check runs straight away, and
+        only after it has seeded the PRNG does the cube draw its animation schedule."""
+        secs, mas = boot_cost(self.s, self.s["old_boot"])
+        self.mas += mas
+        self.t += secs
+        self.battery_update()
+        if self.rng.random() < self.s["boot_wrong_probability"]:
+            self.unhappy()
+
+    def run(self, weeks):
+        end = weeks * WEEK
+        self.boot()
+        next_anim = self.t + self.anim_gap()
+        anims_left = self.nose_anims()
+        rotation = self.next_rotation(self.t)
+
+        while self.t < end:
+            #Happy, checking the orientation every wake until something happens
+            until = min(next_anim, rotation, end)
+            #Changes are only noticed at the next wake
+            period = 8.0 * self.s["check_8secs"]
+            until = self.t + period * max(1, int(-(-(until - self.t) // period)))
+            self.sleep(until - self.t)
+            if self.t >= end:
+                break
+            self.battery_update()
+
+            if self.t >= rotation:
+                self.unhappy()
+                rotation = self.next_rotation(self.t)
+                next_anim = self.t + self.anim_gap()
+                anims_left = self.nose_anims()
+            elif self.t >= next_anim:
+                self.counts["anims"] += 1
+                self.play_anim()
+                next_anim = self.t + self.anim_gap()
+                anims_left -= 1
+                if anims_left <= 0:
+                    #The new nose points the wrong way, so this is an immediate freak out
+                    self.counts["nose_changes"] += 1
+                    anims_left = self.nose_anims()
+                    self.unhappy()
+                    next_anim = self.t + self.anim_gap()
+                    anims_left = self.nose_anims()
+
+        weeks = self.t / WEEK
+        days = self.t / DAY
+        mah_per_day = self.mas / 3600.0 / days
+        if self.flat_at is not None:
+            battery_days = self.flat_at / DAY
+        else:
+            #Not flat yet, so carry on at the same rate
+            left_mah = (used_at_flat(self.s) - self.used()) * self.s["capacity_mah"]
+            battery_days = days + max(0.0, left_mah) / mah_per_day
+        return {
+            "unhappy_per_week": self.counts["unhappy"] / weeks,
+            "apoplexy_per_week": self.counts["apoplexy"] / weeks,
+            "anims_per_day": self.counts["anims"] / days,
+            "nose_changes_per_week": self.counts["nose_changes"] / weeks,
+            "pacified_per_week": self.counts["pacified"] / weeks,
+            "unhappy_mins_per_week": self.unhappy_secs / 60.0 / weeks,
+            "mah_per_day": mah_per_day,
+            "battery_days": battery_days,
+            "battery_level_end": self.level,
+        }
+
+
+def firmware_transitions():
+    """The (from, to) state pairs of behaviour.cpp: each handler's assignments to state."""
+    with open(os.path.join(SRC, "behaviour.cpp")) as f:
+        text = f.read()
+    step = re.search(r"^unsigned int behaviour_step\(\) \{(.*?)^\}", text, re.M | re.S).group(1)
+    handlers = dict((h, s) for s, h in re.findall(r"case BEHAVIOUR_(\w+): sleeps = (\w+)\(\)", step))
+    default = re.search(r"default: sleeps = (\w+)\(\)", step).group(1)
+    handlers.setdefault(default, "HAPPY_CHECK")
+    found = set()
+    for name, body in re.findall(r"^static unsigned int (\w+)\(\) \{(.*?)^\}", text, re.M | re.S):
+        if name not in handlers:
+            continue
+        for to in re.findall(r"\bstate = BEHAVIOUR_(\w+);", body):
+            found.add((handlers[name], to))
+    return found, set(handlers.values())
+
+
+def config_timings():
+    """The behaviour timing fields of ConfigRecord."""
+    with open(os.path.join(SRC, "config.h")) as f:
+        text = f.read()
+    block = re.search(r"//Behaviour timings\n(.*?)\n\n", text, re.S).group(1)
+    return set(re.findall(r"^\s*\w+ (\w+);", block, re.M))
+
+
+def firmware_peripherals():
+    """The peripherals the power manager gates (PERIPH_x of peripherals.h), in lower case."""
+    with open(os.path.join(SRC, "peripherals.h")) as f:
+        text = f.read()
+    return set(p.lower() for p in re.findall(r"^#define PERIPH_(\w+) \d+", text, re.M) if p != "COUNT")
+
+
+def check():
+    """Compare the model with the firmware. Returns a list of differences."""
+    errors = []
+    found, states = firmware_transitions()
+    for t in sorted(found - TRANSITIONS):
+        errors.append("behaviour.cpp goes from {} to {}, which the model does not".format(*t))
+    for t in sorted(TRANSITIONS - found):
+        errors.append("the model goes from {} to {}, which behaviour.cpp does not".format(*t))
+    if len(states) < 5:
+        errors.append("only found the handlers for {} in behaviour.cpp".format(", ".join(sorted(states))))
+    settings = default_settings()
+    for field in sorted(config_timings()):
+        if field not in settings:
+            errors.append("config.h has the timing {}, which the model does not".format(field))
+    for p in sorted(firmware_peripherals() ^ set(PERIPHERALS)):
+        errors.append("the peripheral {} is not in both peripherals.h and the model".format(p))
+    return errors
+
+
+def run_one(job):
+    settings, weeks, seed = job
+    return Simulation(settings, seed).run(weeks)
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p / 100.0 * len(values)))]
+
+
+def summarise(results):
+    out = {}
+    for m in METRICS:
+        vals = [r[m] for r in results]
+        out[m] = (sum(vals) / len(vals), percentile(vals, 5), percentile(vals, 50), percentile(vals, 95))
+    return out
+
+
+def parse_value(v):
+    try:
+        return int(v)
+    except ValueError:
+        return float(v)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Monte Carlo simulator of the JaCube's behaviour")
+    parser.add_argument("--weeks", type=float, default=12, help="length of each run in weeks")
+    parser.add_argument("--runs", type=int, default=100, help="runs per setting")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--jobs", type=int, default=multiprocessing.cpu_count())
+    parser.add_argument("--set", action="append", default=[], metavar="NAME=VALUE")
+    parser.add_argument("--sweep", action="append", default=[], metavar="NAME=V1,V2,...")
+    parser.add_argument("--list", action="store_true", help="show the settings and exit")
+    parser.add_argument("--check", action="store_true", help="check the model against the firmware sources and exit")
+    args = parser.parse_args()
+
+    if args.check:
+        errors = check()
+        for e in errors:
+            print(e)
+        sys.exit(1 if errors else 0)
+
+    base = default_settings()
+    for item in args.set:
+        name, value = item.split("=", 1)
+        if name not in base:
+            sys.exit("Unknown setting {}".format(name))
+        base[name] = parse_value(value)
+
+    if args.list:
+        for name in sorted(base):
+            print("{:24s} {}".format(name, base[name]))
+        print("")
+        for phase in sorted(PHASES):
+            print("{:24s} {:.2f} mA awake ({})".format(phase + " phase", phase_ma(base, phase), ", ".join(PHASES[phase])))
+        print("")
+        print_boot(base)
+        return
+
+    axes = []
+    for item in args.sweep:
+        name, values = item.split("=", 1)
+        if name not in base:
+            sys.exit("Unknown setting {}".format(name))
+        axes.append([(name, parse_value(v)) for v in values.split(",")])
+
+    points = []
+    for combo in itertools.product(*axes):
+        s = dict(base)
+        s.update(combo)
+        points.append((combo, s))
+
+    jobs = [(s, args.weeks, args.seed * 100003 + i) for _, s in points for i in range(args.runs)]
+    pool = multiprocessing.Pool(args.jobs)
+    results = pool.map(run_one, jobs, chunksize=max(1, len(jobs) // (args.jobs * 4)))
+    pool.close()
+
+    if not axes:
+        summary = summarise(results)
+        print("{} runs of {} weeks".format(args.runs, args.weeks))
+        print("{:24s} {:>10s} {:>10s} {:>10s} {:>10s}".format("", "mean", "p5", "p50", "p95"))
+        for m in METRICS:
+            print("{:24s} {:10.2f} {:10.2f} {:10.2f} {:10.2f}".format(m, *summary[m]))
+        print_boot(base)
+        return
+
+    names = [axis[0][0] for axis in axes]
+    print(",".join(names + ["{}_{}".format(m, stat) for m in METRICS for stat in ("mean", "p95")]))
+    for i, (combo, _) in enumerate(points):
+        summary = summarise(results[i * args.runs:(i + 1) * args.runs])
+        row = [str(v) for _, v in combo]
+        for m in METRICS:
+            row += ["{:.3f}".format(summary[m][0]), "{:.3f}".format(summary[m][3])]
+        print(",".join(row))
+
+
+if __name__ == "__main__":
+    main()